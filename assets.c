@@ -0,0 +1,80 @@
+/*
+ * Embedded image assets
+ *
+ * The pixel data itself is generated from the PNGs in data/ at build time (see
+ * tools/png2c.c and the Makefile), so no image is read or decoded at startup.
+ */
+
+#include <stdio.h>
+
+#include "assets.h"
+
+/* Uploads an embedded image straight into a texture */
+SDL_Texture *asset_texture(SDL_Renderer *r, const Asset *asset) {
+  SDL_Texture *tex =
+      SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, asset->w, asset->h);
+  if (!tex) {
+    fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
+    return NULL;
+  }
+  if (SDL_UpdateTexture(tex, NULL, asset->pixels, asset->w * (int)sizeof(Uint32)) != 0) {
+    fprintf(stderr, "SDL_UpdateTexture failed: %s\n", SDL_GetError());
+    SDL_DestroyTexture(tex);
+    return NULL;
+  }
+  SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+  return tex;
+}
+
+/* Copies src of tex into a new w x h texture with linear filtering */
+static SDL_Texture *resample(SDL_Renderer *r, SDL_Texture *tex, const SDL_Rect *src, int w, int h) {
+  SDL_Texture *out = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+  if (!out) {
+    fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
+    return NULL;
+  }
+  SDL_SetRenderTarget(r, out);
+  SDL_SetRenderDrawColor(r, 0, 0, 0, 0);
+  SDL_RenderClear(r);
+  // Copy the alpha channel as is, blending onto the cleared texture would darken the edges
+  SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+  SDL_SetTextureScaleMode(tex, SDL_ScaleModeLinear);
+#endif
+  SDL_RenderCopy(r, tex, src, NULL);
+  SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+  SDL_SetTextureBlendMode(out, SDL_BLENDMODE_BLEND);
+  return out;
+}
+
+/* Resamples src (NULL for all) of a texture into a new w x h texture with linear
+ * filtering.  Done once per layout so that drawing only ever copies 1:1.  Large
+ * reductions halve the image first, so every source pixel still counts */
+SDL_Texture *asset_scale(SDL_Renderer *r, SDL_Texture *tex, const SDL_Rect *src, int w, int h) {
+  SDL_Texture *target = SDL_GetRenderTarget(r);
+  SDL_Texture *cur = tex, *out;
+  SDL_Rect area;
+
+  if (w < 1) w = 1;
+  if (h < 1) h = 1;
+  if (src) {
+    area = *src;
+  } else {
+    area.x = area.y = 0;
+    SDL_QueryTexture(tex, NULL, NULL, &area.w, &area.h);
+  }
+  // At exactly half the size linear filtering averages each 2x2 block
+  while (area.w >= w * 2 && area.h >= h * 2) {
+    SDL_Texture *half = resample(r, cur, &area, area.w / 2, area.h / 2);
+    if (cur != tex) SDL_DestroyTexture(cur);
+    cur = half;
+    if (!cur) break;
+    area.x = area.y = 0;
+    area.w /= 2;
+    area.h /= 2;
+  }
+  out = cur ? resample(r, cur, &area, w, h) : NULL;
+  if (cur && cur != tex) SDL_DestroyTexture(cur);
+  SDL_SetRenderTarget(r, target);
+  return out;
+}
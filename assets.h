@@ -0,0 +1,34 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <SDL2/SDL.h>
+
+/* === Structures === */
+
+// Image decoded at build time by tools/png2c, ARGB8888 pixels
+typedef struct {
+  int w;
+  int h;
+  const Uint32 *pixels;
+} Asset;
+
+/* === Images linked into the binaries (generated from the PNGs in data/) === */
+
+extern const Asset asset_ic;
+extern const Asset asset_needle;
+extern const Asset asset_spritesheet;
+extern const Asset asset_lock;
+extern const Asset asset_unlock;
+
+// The background, needle and sprite sheet at 4x, rendered from art/ic.svg
+extern const Asset asset_ic_4x;
+extern const Asset asset_needle_4x;
+extern const Asset asset_spritesheet_4x;
+extern const Asset asset_joypad;
+
+/* === Prototypes === */
+
+SDL_Texture *asset_texture(SDL_Renderer *r, const Asset *asset);
+SDL_Texture *asset_scale(SDL_Renderer *r, SDL_Texture *tex, const SDL_Rect *src, int w, int h);
+
+#endif // ASSETS_H
@@ -0,0 +1,135 @@
+/*
+ * Benchmark for the flight recorder hot path
+ *
+ * Measures the cost flightrec_record() adds per received frame, for
+ * classic and CAN FD frames, with the ring sized for a 30 second window.
+ * "back-to-back" records as fast as possible and is bound by memory
+ * bandwidth; "paced" puts simulated per-frame RX work between frames, as
+ * on a real bus, and reports the extra time recording adds to that loop.
+ * The paced run alternates short batches with and without recording and
+ * compares the medians, so scheduling noise and frequency changes hit both
+ * sides alike instead of showing up as a negative cost.
+ *
+ * Usage: flightrec_bench [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flightrec.h"
+
+#define DEFAULT_FRAMES 20000000L
+#define WINDOW_SECONDS 30
+#define WORK_ROUNDS 200 // Simulated per-frame work in the paced run
+#define PACED_BATCH 1000 // Frames per timed batch in the paced run
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Stand-in for the rest of the RX path (syscall, decode, ...) */
+static uint64_t rx_work(uint64_t x) {
+  for (int i = 0; i < WORK_ROUNDS; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+  }
+  return x;
+}
+
+/* One batch of paced frames, recording or not, in seconds */
+static double paced_batch(FlightRecorder *fr, struct canfd_frame *cf, int mtu, int record,
+                          uint64_t *x) {
+  struct timeval tv = {0, 0};
+  double t0 = now_sec();
+
+  for (int i = 0; i < PACED_BATCH; i++) {
+    *x = rx_work(*x);
+    cf->data[0] = (uint8_t)*x;
+    if (record) flightrec_record(fr, cf, mtu, &tv);
+  }
+  return now_sec() - t0;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/* Median over alternating batches with and without recording, per frame */
+static double paced(FlightRecorder *fr, struct canfd_frame *cf, int mtu, long batches,
+                    double *work) {
+  double *off = malloc(batches * sizeof(double));
+  double *on = malloc(batches * sizeof(double));
+  uint64_t x = 88172645463325252ULL;
+
+  for (long b = 0; b < batches; b++) {
+    off[b] = paced_batch(fr, cf, mtu, 0, &x);
+    on[b] = paced_batch(fr, cf, mtu, 1, &x);
+  }
+  if (x == 42) printf("\n"); // Keep the work alive
+  qsort(off, batches, sizeof(double), compare_double);
+  qsort(on, batches, sizeof(double), compare_double);
+  *work = off[batches / 2] / PACED_BATCH;
+  double added = (on[batches / 2] - off[batches / 2]) / PACED_BATCH;
+  free(off);
+  free(on);
+  return added;
+}
+
+static void run(const char *label, FlightRecorder *fr, struct canfd_frame *cf, int mtu,
+                long frames) {
+  struct timeval tv = {0, 0};
+  double t0, t1;
+
+  t0 = now_sec();
+  for (long i = 0; i < frames; i++) {
+    cf->data[0] = (uint8_t)i;
+    tv.tv_usec = i % 1000000;
+    flightrec_record(fr, cf, mtu, &tv);
+  }
+  t1 = now_sec();
+  printf("%-8s back-to-back  %.2f ns/frame  %.1f Mframes/s\n", label,
+         (t1 - t0) * 1e9 / frames, frames / (t1 - t0) / 1e6);
+
+  long batches = frames / 10 / PACED_BATCH;
+  double work;
+  double added = paced(fr, cf, mtu, batches < 1 ? 1 : batches, &work);
+  printf("%-8s paced         %.2f ns/frame added (%.0f ns of RX work per frame, %ld batches)\n",
+         label, added * 1e9, work * 1e9, batches);
+}
+
+int main(int argc, char *argv[]) {
+  FlightRecorder fr;
+  struct canfd_frame cf;
+  long frames = (argc > 1) ? atol(argv[1]) : DEFAULT_FRAMES;
+
+  if (flightrec_init(&fr, WINDOW_SECONDS, "vcan0") < 0) {
+    fprintf(stderr, "Could not allocate the ring\n");
+    return 1;
+  }
+  printf("Ring: %llu slots (%.1f MB)\n", (unsigned long long)(fr.mask + 1),
+         (fr.mask + 1) * sizeof(FlightRecord) / 1e6);
+
+  memset(&cf, 0, sizeof(cf));
+  cf.can_id = 0x244;
+  cf.len = CAN_MAX_DLEN;
+  run("classic", &fr, &cf, CAN_MTU, frames);
+  cf.len = CANFD_MAX_DLEN;
+  run("CAN FD", &fr, &cf, CANFD_MTU, frames);
+
+  double t0 = now_sec();
+  long n = flightrec_dump(&fr, "/tmp/flightrec_bench.log", 0);
+  printf("dump     %ld frames in %.1f ms\n", n, (now_sec() - t0) * 1e3);
+
+  // What icsim's render loop waits for on SIGUSR2
+  t0 = now_sec();
+  flightrec_dump_async(&fr, "/tmp/flightrec_bench.log", 0);
+  printf("async    caller blocked for %.3f ms\n", (now_sec() - t0) * 1e3);
+
+  flightrec_free(&fr);
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Bus load accounting
+ *
+ * Works out how many bits a frame occupies on the wire, from the start of
+ * frame to the end of the interframe space, so the load of a traffic mix can
+ * be compared at a given bit rate.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "busload.h"
+
+#define CAN_MAX_FRAME_BITS 160 // Unstuffed SOF..CRC of an extended 8 byte frame is 118
+
+// Frame bits after the CRC: CRC delimiter, ACK slot, ACK delimiter, EOF and IFS
+#define CAN_TAIL_BITS (1 + 1 + 1 + 7 + 3)
+#define CANFD_TAIL_BITS (1 + 1 + 7 + 3) // CRC delimiter counted in the data phase
+
+static int put_bits(uint8_t *bits, int n, uint32_t value, int width) {
+  for (int i = width - 1; i >= 0; i--) bits[n++] = (value >> i) & 1;
+  return n;
+}
+
+static uint16_t crc15(const uint8_t *bits, int n) {
+  uint16_t crc = 0;
+  for (int i = 0; i < n; i++) {
+    int next = bits[i] ^ ((crc >> 14) & 1);
+    crc = (crc << 1) & 0x7fff;
+    if (next) crc ^= 0x4599;
+  }
+  return crc;
+}
+
+/* Stuff bits added after every five equal bits, the stuff bit itself starts the next run */
+static int stuff_bits(const uint8_t *bits, int n) {
+  int stuffed = 0, run = 1;
+  uint8_t last = bits[0];
+
+  for (int i = 1; i < n; i++) {
+    if (bits[i] == last) {
+      if (++run == 5) {
+        stuffed++;
+        last = !last;
+        run = 1;
+      }
+    } else {
+      last = bits[i];
+      run = 1;
+    }
+  }
+  return stuffed;
+}
+
+static uint32_t classic_bits(const struct canfd_frame *cf) {
+  uint8_t bits[CAN_MAX_FRAME_BITS];
+  int len = cf->len > CAN_MAX_DLEN ? CAN_MAX_DLEN : cf->len;
+  int rtr = (cf->can_id & CAN_RTR_FLAG) != 0;
+  int n = 0;
+
+  n = put_bits(bits, n, 0, 1); // SOF
+  if (cf->can_id & CAN_EFF_FLAG) {
+    n = put_bits(bits, n, (cf->can_id >> 18) & 0x7ff, 11);
+    n = put_bits(bits, n, 1, 1); // SRR
+    n = put_bits(bits, n, 1, 1); // IDE
+    n = put_bits(bits, n, cf->can_id & 0x3ffff, 18);
+    n = put_bits(bits, n, rtr, 1);
+    n = put_bits(bits, n, 0, 2); // r1, r0
+  } else {
+    n = put_bits(bits, n, cf->can_id & CAN_SFF_MASK, 11);
+    n = put_bits(bits, n, rtr, 1);
+    n = put_bits(bits, n, 0, 2); // IDE, r0
+  }
+  n = put_bits(bits, n, len, 4);
+  if (!rtr)
+    for (int i = 0; i < len; i++) n = put_bits(bits, n, cf->data[i], 8);
+  n = put_bits(bits, n, crc15(bits, n), 15);
+
+  return n + stuff_bits(bits, n) + CAN_TAIL_BITS;
+}
+
+/* CAN FD frames, and classic ones when worst is set, use the worst case dynamic stuffing */
+static void frame_bits(const struct canfd_frame *cf, int mtu, int worst, uint32_t *nominal,
+                       uint32_t *data) {
+  if (mtu != CANFD_MTU) {
+    if (worst) {
+      // SOF..CRC is 34 (base) or 54 (extended) bits plus the data, 13 bits follow unstuffed
+      int len = cf->len > CAN_MAX_DLEN ? CAN_MAX_DLEN : cf->len;
+      uint32_t stuffed = ((cf->can_id & CAN_EFF_FLAG) ? 54 : 34) + 8 * len;
+      *nominal = stuffed + (stuffed - 1) / 4 + CAN_TAIL_BITS;
+    } else {
+      *nominal = classic_bits(cf);
+    }
+    *data = 0;
+    return;
+  }
+
+  // SOF, identifier, RRS, IDE, FDF, res, BRS (SRR and IDE again for extended IDs)
+  uint32_t arb = (cf->can_id & CAN_EFF_FLAG) ? 1 + 11 + 2 + 18 + 4 : 1 + 11 + 5;
+  // ESI, DLC, data, then stuff count and CRC with a fixed stuff bit every 4 bits
+  uint32_t dyn = 1 + 4 + 8 * cf->len;
+  uint32_t crc = (cf->len > 16) ? 21 : 17;
+  uint32_t fixed = 4 + crc + (4 + crc + 3) / 4;
+
+  arb += (arb - 1) / 4;
+  dyn += (dyn - 1) / 4;
+  if (cf->flags & CANFD_BRS) {
+    *nominal = arb + CANFD_TAIL_BITS;
+    *data = dyn + fixed + 1;
+  } else {
+    *nominal = arb + dyn + fixed + 1 + CANFD_TAIL_BITS;
+    *data = 0;
+  }
+}
+
+void can_frame_bits(const struct canfd_frame *cf, int mtu, uint32_t *nominal, uint32_t *data) {
+  frame_bits(cf, mtu, 0, nominal, data);
+}
+
+void can_frame_bits_worst(const struct canfd_frame *cf, int mtu, uint32_t *nominal, uint32_t *data) {
+  frame_bits(cf, mtu, 1, nominal, data);
+}
+
+void busload_reset(BusLoad *bl) { memset(bl, 0, sizeof(*bl)); }
+
+void busload_add(BusLoad *bl, const struct canfd_frame *cf, int mtu) {
+  uint32_t nominal, data;
+  can_frame_bits(cf, mtu, &nominal, &data);
+  bl->frames++;
+  bl->nominal_bits += nominal;
+  bl->data_bits += data;
+}
+
+double busload_ratio(const BusLoad *bl, double secs, long bitrate, long data_bitrate) {
+  if (secs <= 0) return 0;
+  return ((double)bl->nominal_bits / bitrate + (double)bl->data_bits / data_bitrate) / secs;
+}
+
+void busload_print(const BusLoad *bl, double secs, long bitrate, long data_bitrate) {
+  if (secs <= 0) return;
+  printf("[BUSLOAD] %.0f frames/s, %.0f bits/s (stuffed), %.2f%% of %ld kbit/s", bl->frames / secs,
+         (bl->nominal_bits + bl->data_bits) / secs,
+         busload_ratio(bl, secs, bitrate, data_bitrate) * 100, bitrate / 1000);
+  if (bl->data_bits) printf(" / %ld kbit/s data", data_bitrate / 1000);
+  printf("\n");
+}
@@ -0,0 +1,36 @@
+#ifndef BUSLOAD_H
+#define BUSLOAD_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+#define CAN_BITRATE 500000         // Nominal (arbitration) bit rate
+#define CANFD_DATA_BITRATE 2000000 // CAN FD data phase bit rate when BRS is set
+
+/* === Structures === */
+
+// Bits put on the wire, split by the bit rate they are sent at
+typedef struct {
+  uint64_t frames;
+  uint64_t nominal_bits;
+  uint64_t data_bits; // CAN FD data phase with BRS
+} BusLoad;
+
+/* === Prototypes === */
+
+// Classic frames are counted exactly, bit stuffing included (the CRC is
+// computed to find the stuff bits).  CAN FD frames use the worst case
+// dynamic stuffing plus the fixed stuff bits of the FD CRC field.
+void can_frame_bits(const struct canfd_frame *cf, int mtu, uint32_t *nominal, uint32_t *data);
+// Worst case stuffing for both, constant time for use on the receive path
+void can_frame_bits_worst(const struct canfd_frame *cf, int mtu, uint32_t *nominal, uint32_t *data);
+
+void busload_reset(BusLoad *bl);
+void busload_add(BusLoad *bl, const struct canfd_frame *cf, int mtu);
+// Fraction of the bus time used over secs, 1.0 = saturated
+double busload_ratio(const BusLoad *bl, double secs, long bitrate, long data_bitrate);
+void busload_print(const BusLoad *bl, double secs, long bitrate, long data_bitrate);
+
+#endif // BUSLOAD_H
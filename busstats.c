@@ -0,0 +1,148 @@
+/*
+ * Per ID bus statistics for the receive path
+ *
+ * Every frame icsim receives is charged its worst case wire bits (see
+ * busload.c) and the gap to the previous frame with the same ID, using the
+ * kernel receive timestamp.  The accumulators are fixed tables so adding a
+ * frame is a few loads and stores: standard IDs index a 2048 entry array,
+ * extended IDs go through a small open addressed table.
+ *
+ * A report window is taken by copying the tables out and clearing the per
+ * ID counters, the totals are cumulative so the overlay can sample them
+ * independently.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "busstats.h"
+#include "clock.h"
+
+void busstats_init(BusStats *s, long bitrate, long data_bitrate) {
+  memset(s, 0, sizeof(*s));
+  s->bitrate = bitrate;
+  s->data_bitrate = data_bitrate;
+  s->window_start = clock_ms();
+}
+
+/* Finds or claims the slot of an ID, NULL when the extended table is full */
+static IdStats *id_slot(BusStats *s, canid_t id) {
+  if (!(id & CAN_EFF_FLAG)) return &s->std_ids[id & CAN_SFF_MASK];
+
+  uint32_t h = ((id & CAN_EFF_MASK) * 2654435761U) >> 22; // 10 bits, BUSSTATS_EXT_SLOTS
+  for (int i = 0; i < BUSSTATS_EXT_PROBE; i++) {
+    IdStats *e = &s->ext_ids[(h + i) & (BUSSTATS_EXT_SLOTS - 1)];
+    if (e->used && e->id == id) return e;
+    if (!e->used) return e;
+  }
+  return NULL;
+}
+
+void busstats_add(BusStats *s, const struct canfd_frame *cf, int mtu, const struct timeval *ts) {
+  uint32_t nominal, data;
+  canid_t id = cf->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+  uint64_t now_us = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+
+  can_frame_bits_worst(cf, mtu, &nominal, &data);
+  s->total.frames++;
+  s->total.nominal_bits += nominal;
+  s->total.data_bits += data;
+
+  IdStats *e = id_slot(s, id);
+  if (!e) {
+    s->ext_dropped++;
+    return;
+  }
+  if (!e->used) {
+    e->used = 1;
+    e->id = id;
+  } else if (now_us > e->last_us) {
+    double x = (double)(now_us - e->last_us);
+    double d = x - e->mean_us;
+    e->periods++;
+    e->mean_us += d / e->periods;
+    e->m2 += d * (x - e->mean_us);
+  }
+  e->last_us = now_us;
+  e->frames++;
+  e->nominal_bits += nominal;
+  e->data_bits += data;
+}
+
+static void clear_window(IdStats *ids, int n) {
+  for (int i = 0; i < n; i++) {
+    ids[i].frames = 0;
+    ids[i].nominal_bits = 0;
+    ids[i].data_bits = 0;
+    ids[i].periods = 0;
+    ids[i].mean_us = 0;
+    ids[i].m2 = 0;
+  }
+}
+
+void busstats_window(BusStats *s, BusStats *out) {
+  s->window_end = clock_ms();
+  memcpy(out, s, sizeof(*out));
+  clear_window(s->std_ids, BUSSTATS_STD_IDS);
+  clear_window(s->ext_ids, BUSSTATS_EXT_SLOTS);
+  s->window = s->total;
+  s->window_start = s->window_end;
+}
+
+static long sort_bitrate, sort_data_bitrate;
+
+static double bus_time(const IdStats *e, long bitrate, long data_bitrate) {
+  return (double)e->nominal_bits / bitrate + (double)e->data_bits / data_bitrate;
+}
+
+/* Busiest IDs first */
+static int compare_load(const void *a, const void *b) {
+  double ta = bus_time(*(const IdStats *const *)a, sort_bitrate, sort_data_bitrate);
+  double tb = bus_time(*(const IdStats *const *)b, sort_bitrate, sort_data_bitrate);
+  return (ta < tb) - (ta > tb);
+}
+
+void busstats_print(const BusStats *w) {
+  static const IdStats *active[BUSSTATS_STD_IDS + BUSSTATS_EXT_SLOTS];
+  double secs = (uint32_t)(w->window_end - w->window_start) / 1000.0;
+  BusLoad bl;
+  int n = 0;
+
+  if (secs <= 0) return;
+  bl.frames = w->total.frames - w->window.frames;
+  bl.nominal_bits = w->total.nominal_bits - w->window.nominal_bits;
+  bl.data_bits = w->total.data_bits - w->window.data_bits;
+  busload_print(&bl, secs, w->bitrate, w->data_bitrate);
+
+  for (int i = 0; i < BUSSTATS_STD_IDS; i++)
+    if (w->std_ids[i].frames) active[n++] = &w->std_ids[i];
+  for (int i = 0; i < BUSSTATS_EXT_SLOTS; i++)
+    if (w->ext_ids[i].frames) active[n++] = &w->ext_ids[i];
+  if (n == 0) return;
+  sort_bitrate = w->bitrate;
+  sort_data_bitrate = w->data_bitrate;
+  qsort(active, n, sizeof(active[0]), compare_load);
+
+  printf("[BUSLOAD] %-8s %9s %10s %10s %8s\n", "ID", "frames/s", "period ms", "jitter ms", "load %");
+  for (int i = 0; i < n && i < BUSSTATS_REPORT_TOP; i++) {
+    const IdStats *e = active[i];
+    double load = bus_time(e, w->bitrate, w->data_bitrate) / secs * 100;
+    char id[12];
+
+    if (e->id & CAN_EFF_FLAG) {
+      snprintf(id, sizeof(id), "%08X", e->id & CAN_EFF_MASK);
+    } else {
+      snprintf(id, sizeof(id), "%03X", e->id);
+    }
+    if (e->periods) {
+      printf("[BUSLOAD] %-8s %9.1f %10.2f %10.3f %8.2f\n", id, e->frames / secs, e->mean_us / 1e3,
+             sqrt(e->m2 / e->periods) / 1e3, load);
+    } else {
+      printf("[BUSLOAD] %-8s %9.1f %10s %10s %8.2f\n", id, e->frames / secs, "-", "-", load);
+    }
+  }
+  if (n > BUSSTATS_REPORT_TOP) printf("[BUSLOAD] ... %d more IDs\n", n - BUSSTATS_REPORT_TOP);
+  if (w->ext_dropped) printf("[BUSLOAD] %lu frames with untracked extended IDs\n", (unsigned long)w->ext_dropped);
+}
@@ -0,0 +1,55 @@
+#ifndef BUSSTATS_H
+#define BUSSTATS_H
+
+#include <linux/can.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "busload.h"
+
+/* === Constants === */
+
+#define BUSSTATS_STD_IDS 2048     // One slot per standard ID
+#define BUSSTATS_EXT_SLOTS 1024   // Open addressed table for extended IDs
+#define BUSSTATS_EXT_PROBE 16     // Slots tried before an extended ID is dropped
+#define BUSSTATS_REPORT_MS 5000   // Debug report interval
+#define BUSSTATS_SAMPLE_MS 250    // Overlay update interval
+#define BUSSTATS_REPORT_TOP 16    // IDs listed per report
+
+/* === Structures === */
+
+// Per ID accumulators, the period statistics use Welford's method
+typedef struct {
+  canid_t id;       // CAN_EFF_FLAG set for extended IDs
+  int used;         // Slot has seen this ID
+  uint32_t frames;  // Since the start of the window
+  uint64_t nominal_bits; // Since the start of the window
+  uint64_t data_bits;    // CAN FD data phase with BRS
+  uint64_t last_us; // Timestamp of the previous frame, kept across windows
+  uint32_t periods;
+  double mean_us;   // Mean period
+  double m2;        // Sum of squared differences from the mean
+} IdStats;
+
+// Written by the RX thread only, readers copy it out under the state lock
+typedef struct {
+  long bitrate;
+  long data_bitrate;
+  BusLoad total;              // Since start
+  BusLoad window;             // total at the start of the window
+  uint32_t window_start;      // clock_ms(), so windows follow the virtual clock too
+  uint32_t window_end;        // Set by busstats_window()
+  uint64_t ext_dropped;       // Frames whose extended ID found no slot
+  IdStats std_ids[BUSSTATS_STD_IDS];
+  IdStats ext_ids[BUSSTATS_EXT_SLOTS];
+} BusStats;
+
+/* === Prototypes === */
+
+void busstats_init(BusStats *s, long bitrate, long data_bitrate);
+void busstats_add(BusStats *s, const struct canfd_frame *cf, int mtu, const struct timeval *ts);
+// Copies the window into out and starts a new one
+void busstats_window(BusStats *s, BusStats *out);
+void busstats_print(const BusStats *w);
+
+#endif // BUSSTATS_H
@@ -0,0 +1,83 @@
+/*
+ * CAN error frame counters
+ *
+ * icsim subscribes to every error class and counts them here, so a slow
+ * cluster can be told apart from a degraded bus: protocol errors and bus-off
+ * point at the bus, controller RX overflows at a reader that does not keep up.
+ * CAN FD frames also carry the error state of their sender in the ESI bit,
+ * which shows a node going error passive before any error frame arrives.
+ */
+
+#include <linux/can/error.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "canerr.h"
+#include "lib.h"
+
+void canerr_reset(CanErrorStats *s) {
+  memset(s, 0, sizeof(*s));
+  s->tx_errors = -1;
+  s->rx_errors = -1;
+}
+
+int canerr_add(CanErrorStats *s, const struct canfd_frame *cf) {
+  canid_t class = cf->can_id & CAN_ERR_MASK;
+  uint8_t ctrl = cf->data[1];
+  int changed = !s->frames || class != (s->last.can_id & CAN_ERR_MASK) || ctrl != s->last.data[1];
+
+  s->frames++;
+  if (class & CAN_ERR_BUSOFF) s->bus_off++;
+  if (class & CAN_ERR_LOSTARB) s->lost_arbitration++;
+  if (class & CAN_ERR_PROT) s->protocol++;
+  if (class & CAN_ERR_ACK) s->no_ack++;
+  if (class & CAN_ERR_BUSERROR) s->bus_error++;
+  if (class & CAN_ERR_RESTARTED) s->restarted++;
+  if (class & CAN_ERR_CRTL) {
+    if (ctrl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) s->error_passive++;
+    if (ctrl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) s->error_warning++;
+    if (ctrl & CAN_ERR_CRTL_RX_OVERFLOW) s->rx_overflow++;
+    if (ctrl & CAN_ERR_CRTL_TX_OVERFLOW) s->tx_overflow++;
+  }
+#ifdef CAN_ERR_CNT
+  if (class & CAN_ERR_CNT) {
+    s->tx_errors = cf->data[6];
+    s->rx_errors = cf->data[7];
+  }
+#endif
+  memcpy(&s->last, cf, sizeof(struct can_frame));
+  return changed;
+}
+
+int canerr_add_esi(CanErrorStats *s, const struct canfd_frame *cf) {
+  canid_t id = cf->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+  int changed = !s->fd_esi || id != s->last_esi_id;
+
+  s->fd_esi++;
+  s->last_esi_id = id;
+  return changed;
+}
+
+void canerr_describe(const struct canfd_frame *cf, char *buf, size_t len) {
+  struct canfd_frame copy = *cf;
+  buf[0] = '\0';
+  snprintf_can_error_frame(buf, len, &copy, NULL);
+}
+
+void canerr_print(const CanErrorStats *s) {
+  char last[256];
+
+  if (s->fd_esi)
+    printf("[CANERR] %lu CAN FD frames from error passive senders (ESI), last ID %X\n",
+           (unsigned long)s->fd_esi, s->last_esi_id & CAN_EFF_MASK);
+  if (!s->frames) return;
+  printf("[CANERR] %lu error frames: bus-off %lu, error-passive %lu, warning %lu, lost-arb %lu, "
+         "protocol %lu, rx-overflow %lu, tx-overflow %lu, no-ack %lu, bus-error %lu, restarted %lu",
+         (unsigned long)s->frames, (unsigned long)s->bus_off, (unsigned long)s->error_passive,
+         (unsigned long)s->error_warning, (unsigned long)s->lost_arbitration,
+         (unsigned long)s->protocol, (unsigned long)s->rx_overflow, (unsigned long)s->tx_overflow,
+         (unsigned long)s->no_ack, (unsigned long)s->bus_error, (unsigned long)s->restarted);
+  if (s->tx_errors >= 0) printf(", TEC %d REC %d", s->tx_errors, s->rx_errors);
+  canerr_describe(&s->last, last, sizeof(last));
+  printf("\n[CANERR] Last: %s\n", last);
+}
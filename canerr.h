@@ -0,0 +1,41 @@
+#ifndef CANERR_H
+#define CANERR_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Structures === */
+
+// Error frames received (CAN_RAW_ERR_FILTER), counted by class. A frame
+// can carry several classes, so the classes do not add up to frames.
+typedef struct {
+  uint64_t frames;
+  uint64_t bus_off;
+  uint64_t error_passive; // Controller went RX or TX error passive
+  uint64_t error_warning;
+  uint64_t lost_arbitration;
+  uint64_t protocol;      // Bit, form and stuff errors
+  uint64_t rx_overflow;   // Controller RX buffer overflow
+  uint64_t tx_overflow;
+  uint64_t no_ack;
+  uint64_t bus_error;
+  uint64_t restarted;
+  int tx_errors;          // Last TEC/REC reported by the controller, -1 when never
+  int rx_errors;
+  struct canfd_frame last;
+  uint64_t fd_esi;        // CAN FD data frames sent by an error passive node (ESI)
+  canid_t last_esi_id;
+} CanErrorStats;
+
+/* === Prototypes === */
+
+void canerr_reset(CanErrorStats *s);
+// Returns 1 when the classes differ from the previous error frame
+int canerr_add(CanErrorStats *s, const struct canfd_frame *cf);
+// Counts a CAN FD frame with CANFD_ESI set. Returns 1 when it came from another ID than the last
+int canerr_add_esi(CanErrorStats *s, const struct canfd_frame *cf);
+void canerr_print(const CanErrorStats *s);
+// Decoded text of one error frame, see snprintf_can_error_frame()
+void canerr_describe(const struct canfd_frame *cf, char *buf, size_t len);
+
+#endif // CANERR_H
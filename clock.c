@@ -0,0 +1,58 @@
+/*
+ * Simulation clock
+ *
+ * In real mode this is a thin wrapper over CLOCK_MONOTONIC.  In virtual mode
+ * time only moves when the program delays (or an event source moves it
+ * forward), so loops that pace themselves with clock_delay() run as fast as
+ * the work allows while every timer sees exactly the same sequence of times.
+ * In driven mode only an event source moves time (icsim follows the receive
+ * timestamps of the traffic), and delays still sleep to pace the display.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "clock.h"
+
+static int clock_mode = CLOCK_REAL;
+static struct timespec epoch;
+static _Atomic uint32_t virtual_ms;
+
+void clock_init(int mode) {
+  clock_mode = mode;
+  clock_gettime(CLOCK_MONOTONIC, &epoch);
+  atomic_store(&virtual_ms, 0);
+}
+
+int clock_is_virtual(void) { return clock_mode != CLOCK_REAL; }
+
+uint32_t clock_ms(void) {
+  struct timespec now;
+
+  if (clock_mode != CLOCK_REAL) return atomic_load_explicit(&virtual_ms, memory_order_acquire);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)((now.tv_sec - epoch.tv_sec) * 1000 + (now.tv_nsec - epoch.tv_nsec) / 1000000);
+}
+
+void clock_delay(uint32_t ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+
+  if (clock_mode == CLOCK_VIRTUAL) {
+    atomic_fetch_add_explicit(&virtual_ms, ms, memory_order_acq_rel);
+    return;
+  }
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    ;
+}
+
+void clock_advance_to(uint32_t ms) {
+  uint32_t cur = atomic_load_explicit(&virtual_ms, memory_order_acquire);
+
+  if (clock_mode == CLOCK_REAL) return;
+  // Several threads may push time forward, keep the largest
+  while ((int32_t)(ms - cur) > 0 &&
+         !atomic_compare_exchange_weak_explicit(&virtual_ms, &cur, ms, memory_order_acq_rel,
+                                                memory_order_acquire))
+    ;
+}
@@ -0,0 +1,23 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/* === Constants === */
+
+#define CLOCK_REAL 0    // Monotonic wall time, delays sleep
+#define CLOCK_VIRTUAL 1 // Simulated time, delays advance the clock instantly
+#define CLOCK_DRIVEN 2  // Simulated time moved only by clock_advance_to(), delays sleep
+
+/* === Prototypes === */
+
+// Every timer in icsim and controls (auto-lock, UDS seed timeout, turn
+// signal blinking, acceleration steps) reads time through these instead of
+// SDL_GetTicks()/SDL_Delay() so a run can be replayed faster than real time.
+void clock_init(int mode);
+int clock_is_virtual(void);
+uint32_t clock_ms(void);            // Milliseconds since clock_init(), like SDL_GetTicks()
+void clock_delay(uint32_t ms);      // Sleeps, or advances virtual time by ms
+void clock_advance_to(uint32_t ms); // Moves virtual time forward, never back
+
+#endif // CLOCK_H
@@ -0,0 +1,226 @@
+/*
+ * Instrument cluster drawing
+ *
+ * The gauge table and the textures it draws with, composed into ic_frame.
+ * icsim presents ic_frame in its window; tools without a window (icreplay -p)
+ * use a software renderer on a surface and read the pixels back instead, so
+ * both go through the same redraw_ic().
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assets.h"
+#include "cluster.h"
+#include "gauge.h"
+
+SDL_Renderer *renderer = NULL;
+SDL_Texture *base_texture = NULL; // Artwork layout_ic() resamples from, see pick_art()
+SDL_Texture *needle_tex = NULL;
+SDL_Texture *sprite_tex = NULL;
+SDL_Texture *lock_tex = NULL;
+SDL_Texture *unlock_tex = NULL;
+SDL_Texture *ic_frame = NULL;
+SDL_Texture *ic_background = NULL; // base_texture resampled to the current size
+SDL_Rect ic_view;
+static int composed = 0; // ic_frame holds a full redraw since the last layout
+
+// Artwork at 1x and 4x.  Clusters drawn larger than 1x resample from the 4x set
+static const Asset *const art_1x[] = {&asset_ic, &asset_needle, &asset_spritesheet};
+static const Asset *const art_4x[] = {&asset_ic_4x, &asset_needle_4x, &asset_spritesheet_4x};
+static SDL_Texture **const art_tex[] = {&base_texture, &needle_tex, &sprite_tex};
+#define NUM_ART ((int)(sizeof(art_1x) / sizeof(art_1x[0])))
+static SDL_Texture *tex_1x[NUM_ART], *tex_4x[NUM_ART];
+
+// Cluster widgets, drawn in this order.  dst is in fractions of the cluster, src in
+// fractions of the sprite sheet
+static Gauge gauges[] = {
+  // Speedometer
+  {.type = GAUGE_NEEDLE, .source = GAUGE_SRC_SPEED, .min = 0, .max = 280, .steps = 180,
+   .dst = {0.3064, 0.5319, 0.2225, 0.1185}, .tex = &needle_tex, .pivot = {0.8766, 0.5128},
+   .max_angle = 180},
+  // Tachometer
+  {.type = GAUGE_BAR, .source = GAUGE_SRC_RPM, .min = 0, .max = 8000, .steps = 100,
+   .dst = {0.0578, 0.7964, 0.4335, 0.0426}, .color = {255, 140, 0, 255}},
+  // Turn signals
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_TURN_LEFT, .dst = {0.2760, 0.0881, 0.0650, 0.1368},
+   .tex = &sprite_tex, .src = {0.0094, 0.0036, 0.1406, 0.1636}},
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_TURN_RIGHT, .dst = {0.6647, 0.0881, 0.0650, 0.1368},
+   .tex = &sprite_tex, .src = {0.8500, 0.0036, 0.1406, 0.1636}},
+  // Red body when any door is unlocked, then each open door
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_ANY_DOOR, .dst = {0.6040, 0.6596, 0.0650, 0.2523},
+   .tex = &sprite_tex, .src = {0.7188, 0.6873, 0.1406, 0.3018}},
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_DOOR_FL, .dst = {0.5751, 0.7325, 0.0303, 0.0669},
+   .tex = &sprite_tex, .src = {0.6562, 0.7745, 0.0656, 0.0800}},
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_DOOR_FR, .dst = {0.6676, 0.7264, 0.0303, 0.0669},
+   .tex = &sprite_tex, .src = {0.8562, 0.7673, 0.0656, 0.0800}},
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_DOOR_RL, .dst = {0.5751, 0.7964, 0.0303, 0.0669},
+   .tex = &sprite_tex, .src = {0.6562, 0.8509, 0.0656, 0.0800}},
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_DOOR_RR, .dst = {0.6676, 0.8055, 0.0303, 0.0669},
+   .tex = &sprite_tex, .src = {0.8562, 0.8618, 0.0656, 0.0800}},
+  // Handbrake lamp
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_HANDBRAKE, .dst = {0.5058, 0.7872, 0.0289, 0.0608},
+   .color = {220, 0, 0, 255}},
+  // UDS security lock, bottom right
+  {.type = GAUGE_TELLTALE, .source = GAUGE_SRC_LOCKED, .dst = {0.9133, 0.8176, 0.0723, 0.1520},
+   .tex = &lock_tex, .off_tex = &unlock_tex},
+  // Bus load overlay (-B), top left, must stay last
+  {.type = GAUGE_BAR, .source = GAUGE_SRC_BUS_LOAD, .min = 0, .max = 100, .steps = 100,
+   .dst = {0.0145, 0.0304, 0.1445, 0.0182}, .color = {0, 200, 80, 255}}
+};
+#define NUM_GAUGES ((int)(sizeof(gauges) / sizeof(gauges[0])))
+static int num_gauges = NUM_GAUGES - 1; // Without the overlay
+
+/* Points the artwork textures at the 1x or the 4x set.  The 4x set is uploaded
+ * on first use, so a cluster at its default size never touches it */
+static int pick_art(double scale) {
+  int hd = scale > 1;
+
+  for (int i = 0; i < NUM_ART; i++) {
+    if (hd && !tex_4x[i]) tex_4x[i] = asset_texture(renderer, art_4x[i]);
+    if (hd && !tex_4x[i]) return -1;
+    *art_tex[i] = hd ? tex_4x[i] : tex_1x[i];
+  }
+  return 0;
+}
+
+/* Fits the cluster to the window keeping its aspect ratio and rebuilds every
+ * scaled texture, so frames are only ever copied 1:1. Returns 0 on success */
+int layout_ic() {
+  int out_w, out_h;
+
+  if (SDL_GetRendererOutputSize(renderer, &out_w, &out_h) != 0) return -1;
+  double scale = fmin((double)out_w / SCREEN_WIDTH, (double)out_h / SCREEN_HEIGHT);
+  ic_view.w = (int)lround(SCREEN_WIDTH * scale);
+  ic_view.h = (int)lround(SCREEN_HEIGHT * scale);
+  if (ic_view.w < 1 || ic_view.h < 1) return -1;
+  ic_view.x = (out_w - ic_view.w) / 2;
+  ic_view.y = (out_h - ic_view.h) / 2;
+
+  SDL_SetRenderTarget(renderer, NULL);
+  if (pick_art(scale) < 0) return -1;
+  gauge_free(gauges, NUM_GAUGES);
+  if (ic_background) SDL_DestroyTexture(ic_background);
+  if (ic_frame) SDL_DestroyTexture(ic_frame);
+  ic_background = asset_scale(renderer, base_texture, NULL, ic_view.w, ic_view.h);
+  ic_frame = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                               ic_view.w, ic_view.h);
+  if (!ic_background || !ic_frame) return -1;
+  SDL_SetRenderTarget(renderer, ic_frame);
+  composed = 0;
+  if (debug)
+    printf("[DEBUG] Cluster drawn at %dx%d (scale %.2f) from the %s artwork\n", ic_view.w, ic_view.h,
+           scale, scale > 1 ? "4x" : "1x");
+  return gauge_init(renderer, ic_background, gauges, num_gauges);
+}
+
+/* Redraws the IC updating everything */
+void redraw_ic(CarState* snapshot) {
+  SDL_RenderCopy(renderer, ic_background, NULL, NULL);
+  gauge_invalidate(gauges, num_gauges);
+  gauge_update(gauges, num_gauges, snapshot);
+  gauge_render(renderer, gauges, num_gauges);
+  composed = 1;
+}
+
+/* Redraws only the gauges that changed, returns 0 when nothing did */
+int update_ic(CarState* snapshot) {
+  if (gauge_update(gauges, num_gauges, snapshot) == 0) return 0;
+  gauge_render(renderer, gauges, num_gauges);
+  return 1;
+}
+
+/* Puts the composed cluster on screen, letterboxed when the window has another shape */
+void present_ic() {
+  SDL_SetRenderTarget(renderer, NULL);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+  SDL_RenderCopy(renderer, ic_frame, NULL, &ic_view);
+  SDL_RenderPresent(renderer);
+  SDL_SetRenderTarget(renderer, ic_frame);
+}
+
+/* Images are linked in pre-decoded, see assets.h. Returns 0 on success */
+int cluster_load(SDL_Renderer *r, int bus_overlay) {
+  renderer = r;
+  for (int i = 0; i < NUM_ART; i++) {
+    tex_1x[i] = asset_texture(renderer, art_1x[i]);
+    if (!tex_1x[i]) return -1;
+  }
+  lock_tex = asset_texture(renderer, &asset_lock);
+  unlock_tex = asset_texture(renderer, &asset_unlock);
+  if (!lock_tex || !unlock_tex) return -1;
+  if (bus_overlay) num_gauges = NUM_GAUGES;
+  return 0;
+}
+
+void cluster_free() {
+  gauge_free(gauges, NUM_GAUGES);
+  if (ic_background) SDL_DestroyTexture(ic_background);
+  if (ic_frame) SDL_DestroyTexture(ic_frame);
+  for (int i = 0; i < NUM_ART; i++) {
+    SDL_DestroyTexture(tex_1x[i]);
+    if (tex_4x[i]) SDL_DestroyTexture(tex_4x[i]);
+    tex_1x[i] = tex_4x[i] = NULL;
+  }
+  SDL_DestroyTexture(lock_tex);
+  SDL_DestroyTexture(unlock_tex);
+  ic_background = ic_frame = NULL;
+}
+
+/* Draws state into ic_frame and reads it back.  Only the gauges that changed
+ * since the previous snapshot are redrawn.  Returns 1 when the picture changed,
+ * 0 when it is the same as the last one and -1 on error */
+int cluster_snapshot(CarState *state, Uint32 *pixels, int pitch) {
+  int changed = 1;
+
+  if (!composed) {
+    redraw_ic(state);
+  } else {
+    changed = update_ic(state);
+  }
+  if (SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels, pitch) != 0) {
+    fprintf(stderr, "SDL_RenderReadPixels failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  return changed;
+}
+
+/* PNG when path ends in .png, binary PPM otherwise. Returns 0 on success */
+int cluster_write_image(const char *path, const Uint32 *pixels, int w, int h, int pitch) {
+  size_t len = strlen(path);
+
+  if (len > 4 && !strcmp(path + len - 4, ".png")) {
+    SDL_Surface *s = SDL_CreateRGBSurfaceWithFormatFrom((void *)pixels, w, h, 32, pitch, SDL_PIXELFORMAT_ARGB8888);
+    int ret = s ? IMG_SavePNG(s, path) : -1;
+    if (ret < 0) fprintf(stderr, "Could not write %s: %s\n", path, SDL_GetError());
+    SDL_FreeSurface(s);
+    return ret < 0 ? -1 : 0;
+  }
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  Uint8 *row = malloc(w * 3);
+  int ok = row != NULL;
+  fprintf(fp, "P6\n%d %d\n255\n", w, h);
+  for (int y = 0; ok && y < h; y++) {
+    const Uint32 *px = (const Uint32 *)((const Uint8 *)pixels + y * pitch);
+    for (int x = 0; x < w; x++) {
+      row[x * 3] = px[x] >> 16;
+      row[x * 3 + 1] = px[x] >> 8;
+      row[x * 3 + 2] = px[x];
+    }
+    ok = fwrite(row, 3, w, fp) == (size_t)w;
+  }
+  free(row);
+  if (fclose(fp) != 0) ok = 0;
+  if (!ok) fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,30 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <SDL2/SDL.h>
+
+#include "icsim.h"
+
+/* === Global Variables (See cluster.c) === */
+
+extern SDL_Renderer *renderer;
+extern SDL_Texture *ic_frame; // Cluster is composed here, then presented or read back
+extern SDL_Rect ic_view;      // Where the cluster sits in the window
+
+/* === Prototypes === */
+
+// Loads the textures, layout_ic() then sizes the cluster to the output of r
+int cluster_load(SDL_Renderer *r, int bus_overlay);
+void cluster_free(void);
+
+// Rendering functions
+int layout_ic(void);
+void redraw_ic(CarState *snapshot);
+int update_ic(CarState *snapshot);
+void present_ic(void);
+
+// Snapshots, ARGB8888 pixels of ic_view.w x ic_view.h
+int cluster_snapshot(CarState *state, Uint32 *pixels, int pitch);
+int cluster_write_image(const char *path, const Uint32 *pixels, int w, int h, int pitch);
+
+#endif // CLUSTER_H
@@ -0,0 +1,175 @@
+/*
+ * Line based command socket for driving controls from another process
+ *
+ * Clients connect to a Unix stream socket and write newline terminated
+ * commands; every command gets exactly one reply line, in order.  Clients may
+ * pipeline: everything that arrived is handled in one pass and the replies
+ * go out with a single write.  A client that stops reading its replies is
+ * not read from until its reply buffer drains.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cmdsock.h"
+
+int cmdsock_open(CmdSock *cs, const char *path) {
+  struct sockaddr_un sa;
+
+  memset(cs, 0, sizeof(*cs));
+  for (int i = 0; i < CMDSOCK_MAX_CLIENTS; i++) cs->clients[i].fd = -1;
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+
+  cs->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (cs->listen_fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  unlink(path); // Left over from a previous run
+  if (bind(cs->listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(cs->listen_fd, 4) < 0) {
+    perror(path);
+    close(cs->listen_fd);
+    return -1;
+  }
+  strcpy(cs->path, path);
+  return 0;
+}
+
+void cmdsock_close(CmdSock *cs) {
+  for (int i = 0; i < CMDSOCK_MAX_CLIENTS; i++)
+    if (cs->clients[i].fd >= 0) close(cs->clients[i].fd);
+  close(cs->listen_fd);
+  unlink(cs->path);
+}
+
+static void drop_client(CmdClient *c) {
+  close(c->fd);
+  c->fd = -1;
+}
+
+static void accept_clients(CmdSock *cs) {
+  int fd;
+
+  while ((fd = accept4(cs->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    CmdClient *c = NULL;
+    for (int i = 0; i < CMDSOCK_MAX_CLIENTS && !c; i++)
+      if (cs->clients[i].fd < 0) c = &cs->clients[i];
+    if (!c) {
+      static const char busy[] = "ERR too many clients\n";
+      if (send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL) < 0) {} // Best effort
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->in_len = c->out_len = 0;
+    c->closing = 0;
+  }
+}
+
+/* Sends what is buffered, returns -1 when the client is gone */
+static int flush_client(CmdClient *c) {
+  while (c->out_len) {
+    // A client that went away must not take controls down with SIGPIPE
+    ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+    if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    memmove(c->out, c->out + n, c->out_len - n);
+    c->out_len -= n;
+  }
+  return 0;
+}
+
+/* Runs the complete lines in the input buffer while there is room for replies */
+static int run_commands(CmdSock *cs, CmdClient *c, CmdHandler handler) {
+  char *start = c->in, *end = c->in + c->in_len, *nl;
+  int handled = 0;
+
+  while (!c->closing && (nl = memchr(start, '\n', end - start)) &&
+         CMDSOCK_OUT_LEN - c->out_len > CMDSOCK_LINE_LEN) {
+    char reply[CMDSOCK_LINE_LEN];
+    *nl = '\0';
+    if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+    reply[0] = '\0';
+    if (handler(start, reply, sizeof(reply)) == CMDSOCK_CLOSE) c->closing = 1;
+    c->out_len += snprintf(c->out + c->out_len, CMDSOCK_OUT_LEN - c->out_len, "%s\n", reply);
+    start = nl + 1;
+    handled++;
+  }
+  c->in_len = end - start;
+  memmove(c->in, start, c->in_len);
+  cs->commands += handled;
+  return handled;
+}
+
+int cmdsock_poll(CmdSock *cs, int timeout_ms, CmdHandler handler) {
+  struct pollfd fds[CMDSOCK_MAX_CLIENTS + 1];
+  CmdClient *owner[CMDSOCK_MAX_CLIENTS + 1];
+  int n = 0, handled = 0;
+
+  fds[n].fd = cs->listen_fd;
+  fds[n].events = POLLIN;
+  owner[n++] = NULL;
+  for (int i = 0; i < CMDSOCK_MAX_CLIENTS; i++) {
+    CmdClient *c = &cs->clients[i];
+    if (c->fd < 0) continue;
+    fds[n].fd = c->fd;
+    fds[n].events = 0;
+    // Back pressure: stop reading while the replies are not being read
+    if (c->in_len < CMDSOCK_IN_LEN && c->out_len < CMDSOCK_OUT_LEN / 2 && !c->closing)
+      fds[n].events |= POLLIN;
+    if (c->out_len) fds[n].events |= POLLOUT;
+    owner[n++] = c;
+  }
+
+  if (poll(fds, n, timeout_ms) < 0) {
+    if (errno == EINTR) return 0;
+    perror("poll");
+    return -1;
+  }
+  if (fds[0].revents & POLLIN) accept_clients(cs);
+
+  for (int i = 1; i < n; i++) {
+    CmdClient *c = owner[i];
+    if (!fds[i].revents) continue;
+
+    if (fds[i].revents & POLLIN) {
+      ssize_t got = read(c->fd, c->in + c->in_len, CMDSOCK_IN_LEN - c->in_len);
+      if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+        drop_client(c);
+        continue;
+      }
+      if (got > 0) c->in_len += got;
+      handled += run_commands(cs, c, handler);
+      if (c->in_len == CMDSOCK_IN_LEN) {
+        // A line longer than the whole buffer, nothing sensible to do with it
+        drop_client(c);
+        continue;
+      }
+    } else if (fds[i].revents & (POLLHUP | POLLERR)) {
+      drop_client(c);
+      continue;
+    }
+    if (flush_client(c) < 0 || (c->closing && !c->out_len)) {
+      drop_client(c);
+      continue;
+    }
+    // Replies drained, run the commands that were held back
+    if (c->in_len && c->out_len == 0) {
+      handled += run_commands(cs, c, handler);
+      if (flush_client(c) < 0) drop_client(c);
+    }
+  }
+  return handled;
+}
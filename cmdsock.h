@@ -0,0 +1,47 @@
+#ifndef CMDSOCK_H
+#define CMDSOCK_H
+
+#include <stddef.h>
+#include <sys/un.h>
+
+/* === Constants === */
+
+#define CMDSOCK_MAX_CLIENTS 8
+#define CMDSOCK_IN_LEN 8192   // Per client input buffer, commands are pipelined
+#define CMDSOCK_OUT_LEN 16384 // Per client reply buffer
+#define CMDSOCK_LINE_LEN 256  // Longest command or reply line
+
+// Handler results
+#define CMDSOCK_OK 0
+#define CMDSOCK_CLOSE 1 // Send the reply, then close the connection
+
+/* === Structures === */
+
+typedef struct {
+  int fd; // -1 when unused
+  char in[CMDSOCK_IN_LEN];
+  size_t in_len;
+  char out[CMDSOCK_OUT_LEN];
+  size_t out_len;
+  int closing;
+} CmdClient;
+
+typedef struct {
+  int listen_fd;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  CmdClient clients[CMDSOCK_MAX_CLIENTS];
+  long commands; // Handled so far
+} CmdSock;
+
+// Runs one command line (without the newline) and writes a one line reply
+typedef int (*CmdHandler)(char *line, char *reply, size_t len);
+
+/* === Prototypes === */
+
+int cmdsock_open(CmdSock *cs, const char *path);
+void cmdsock_close(CmdSock *cs);
+// Waits up to timeout_ms for commands and runs every complete line received.
+// Returns the number of commands handled, or -1 on error.
+int cmdsock_poll(CmdSock *cs, int timeout_ms, CmdHandler handler);
+
+#endif // CMDSOCK_H
@@ -21,6 +21,16 @@
 #include <SDL2/SDL_image.h>
 #include <locale.h>
 
+#include "assets.h"
+#include "clock.h"
+#include "latency.h"
+#include "layout.h"
+#include "busload.h"
+#include "scenario.h"
+#include "cmdsock.h"
+#include "logplay.h"
+#include "logindex.h"
+
 #ifndef DATA_DIR
 #define DATA_DIR "./data/"
 #endif
@@ -89,8 +99,17 @@
 #define MODEL_BMW_X1_SPEED_BYTE 0
 #define MODEL_BMW_X1_RPM_ID 0x0AA
 #define MODEL_BMW_X1_RPM_BYTE 4
-#define MODEL_BMW_X1_HANDBRAKE_ID 0x1B4  // Not implemented yet
+#define MODEL_BMW_X1_HANDBRAKE_ID 0x1B4  // Shares the speed frame
 #define MODEL_BMW_X1_HANDBRAKE_BYTE 5
+#define MODEL_BMW_X1_HANDBRAKE_BIT 0x02
+#define BUSLOAD_REPORT_MS 5000
+#define SCENARIO_BURST 256 // Scenario actions per pass of the main loop
+#define IDLE_RPM 800
+#define RPM_PER_MPH 45
+// Latency benchmark (-L): speed steps large enough to always move the needle
+#define LATENCY_LOW_MPH 20
+#define LATENCY_HIGH_MPH 60
+#define LATENCY_INPUT_MS 100 // Plus up to 16 ms of jitter so inputs drift across frames
 
 
 int gButtonY = BUTTON_Y;
@@ -118,6 +137,7 @@ int gLastAccelValue = 0; // Non analog R2
 int s; // socket
 struct canfd_frame cf;
 char *traffic_log = DEFAULT_CAN_TRAFFIC;
+uint64_t traffic_start = 0; // -T, microseconds into the first pass of the log
 struct ifreq ifr;
 int door_pos = DEFAULT_DOOR_POS;
 int signal_pos = DEFAULT_SIGNAL_POS;
@@ -135,10 +155,32 @@ char signal_state = 0;
 int throttle = 0;
 float current_speed = 0;
 int turning = 0;
+int handbrake = OFF;
 int door_id, signal_id, speed_id;
 int currentTime;
 int lastAccel = 0;
 int lastTurnSignal = 0;
+const FrameLayout *layout = NULL; // Packed signals (-A), NULL for one message per signal
+int lastPacked = 0;
+int packed_sent = 0; // Values in the last packed frame
+char packed_door, packed_signal;
+float packed_speed;
+int show_busload = 0;
+BusLoad busload;
+int lastBusload = 0;
+int latency_inputs = 0; // Automated inputs to send, 0 when not benchmarking
+int latency_sent = 0;
+int nextLatencyInput = 0;
+Uint8 latency_seq = 0;
+char *scenario_file = NULL; // Headless mode (-S)
+Scenario scenario;
+char *command_socket = NULL; // Headless command API (-U)
+CmdSock cmdsock;
+Scenario commands; // Random generator for ranges in commands
+int headless = 0;
+int can_mtu = CAN_MTU;
+int shutdown_requested = 0;
+long frames_sent = 0;
 
 int seed = 0;
 int debug = 0;
@@ -154,6 +196,7 @@ SDL_Texture *base_texture = NULL;
 int gControllerType = USB_CONTROLLER;
 
 void kk_check(int);
+void send_packed(int force);
 
 // Adds data dir to file name
 // Uses a single pointer so not to have a memory leak
@@ -169,7 +212,10 @@ char *get_data(char *fname) {
 void send_pkt(int mtu) {
   if(write(s, &cf, mtu) != mtu) {
 	perror("write");
+	return;
   }
+  frames_sent++;
+  if(show_busload) busload_add(&busload, &cf, mtu);
 }
 
 // Randomizes bytes in CAN packet if difficulty is hard enough
@@ -183,6 +229,10 @@ void randomize_pkt(int start, int stop) {
 
 void send_lock(char door) {
 	door_state |= door;
+	if (layout) {
+		send_packed(0);
+		return;
+	}
 	memset(&cf, 0, sizeof(cf));
 	cf.can_id = door_id;
 	cf.len = door_len;
@@ -194,6 +244,10 @@ void send_lock(char door) {
 
 void send_unlock(char door) {
 	door_state &= ~door;
+	if (layout) {
+		send_packed(0);
+		return;
+	}
 	memset(&cf, 0, sizeof(cf));
 	cf.can_id = door_id;
 	cf.len = door_len;
@@ -203,42 +257,104 @@ void send_unlock(char door) {
 	send_pkt(CAN_MTU);
 }
 
-void send_speed() {
+// Stamps the speed frame for the latency benchmark, using its padding bytes
+void tag_speed_frame() {
+	if (!latency_inputs) return;
+	Uint32 used = 3U << speed_pos;
+	if (model && !strncmp(model, "bmw", 3)) used |= 1U << MODEL_BMW_X1_HANDBRAKE_BYTE;
+	cf.len = CAN_MAX_DLEN;
+	latency_pack(cf.data, cf.len, used, latency_seq, latency_now_us());
+}
+
+// Writes the current speed into p[0..1] in the encoding of the selected model
+void encode_speed(unsigned char *p) {
 	if (model) {
-		if (!strncmp(model, "bmw", 3)) {
-		        int b = ((16 * current_speed)/256) + 208;
-			int a = 16 * current_speed - ((b-208) * 256);
-		        memset(&cf, 0, sizeof(cf));
-		        cf.can_id = speed_id;
-		        cf.len = speed_len;
-		        cf.data[speed_pos+1] = (char)b & 0xff;
-		        cf.data[speed_pos] = (char)a & 0xff;
-		        if(current_speed == 0) { // IDLE
-		                cf.data[speed_pos] = rand() % 80;
-		                cf.data[speed_pos+1] = 208;
-		        }
-		        if (speed_pos) randomize_pkt(0, speed_pos);
-		        if (speed_len != speed_pos + 2) randomize_pkt(speed_pos+2, speed_len);
-		        send_pkt(CAN_MTU);
+		int b = ((16 * current_speed)/256) + 208;
+		int a = 16 * current_speed - ((b-208) * 256);
+		p[1] = (char)b & 0xff;
+		p[0] = (char)a & 0xff;
+		if(current_speed == 0) { // IDLE
+			p[0] = rand() % 80;
+			p[1] = 208;
 		}
 	} else {
 		int kph = (current_speed / 0.6213751) * 100;
-		memset(&cf, 0, sizeof(cf));
-		cf.can_id = speed_id;
-		cf.len = speed_len;
-		cf.data[speed_pos+1] = (char)kph & 0xff;
-		cf.data[speed_pos] = (char)(kph >> 8) & 0xff;
+		p[1] = (char)kph & 0xff;
+		p[0] = (char)(kph >> 8) & 0xff;
 		if(kph == 0) { // IDLE
-			cf.data[speed_pos] = 1;
-			cf.data[speed_pos+1] = rand() % 255+100;
+			p[0] = 1;
+			p[1] = rand() % 255+100;
 		}
-		if (speed_pos) randomize_pkt(0, speed_pos);
-		if (speed_len != speed_pos + 2) randomize_pkt(speed_pos+2, speed_len);
-		send_pkt(CAN_MTU);
 	}
 }
 
+// Sends the packed frame when one of its fields changed, or always when forced (-A)
+void send_packed(int force) {
+	if (!force && packed_sent && door_state == packed_door && signal_state == packed_signal &&
+	    current_speed == packed_speed) return;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = layout->id;
+	cf.len = layout->len;
+	if (layout->fd) cf.flags = CANFD_BRS;
+	// Bytes between the fields are padding, like in the single messages
+	for (int i = 0; i < layout->len; i++) {
+		if (i == layout->pos[LAYOUT_DOOR] || i == layout->pos[LAYOUT_SIGNAL] ||
+		    i == layout->pos[LAYOUT_SPEED] || i == layout->pos[LAYOUT_SPEED] + 1) continue;
+		randomize_pkt(i, i + 1);
+	}
+	cf.data[layout->pos[LAYOUT_DOOR]] = door_state;
+	cf.data[layout->pos[LAYOUT_SIGNAL]] = signal_state;
+	encode_speed(&cf.data[layout->pos[LAYOUT_SPEED]]);
+	send_pkt(layout->fd ? CANFD_MTU : CAN_MTU);
+	packed_door = door_state;
+	packed_signal = signal_state;
+	packed_speed = current_speed;
+	packed_sent = 1;
+	lastPacked = currentTime;
+}
+
+void send_speed() {
+	if (layout) {
+		send_packed(0);
+		return;
+	}
+	if (model && strncmp(model, "bmw", 3)) return;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = speed_id;
+	cf.len = speed_len;
+	encode_speed(&cf.data[speed_pos]);
+	if (speed_pos) randomize_pkt(0, speed_pos);
+	if (speed_len != speed_pos + 2) randomize_pkt(speed_pos+2, speed_len);
+	if (model) {
+		if (handbrake) {
+			cf.data[MODEL_BMW_X1_HANDBRAKE_BYTE] |= MODEL_BMW_X1_HANDBRAKE_BIT;
+		} else {
+			cf.data[MODEL_BMW_X1_HANDBRAKE_BYTE] &= ~MODEL_BMW_X1_HANDBRAKE_BIT;
+		}
+	}
+	tag_speed_frame();
+	send_pkt(CAN_MTU);
+}
+
+// Engine speed follows the vehicle speed, only sent for models that have it
+void send_rpm() {
+	if (!model || strncmp(model, "bmw", 3)) return;
+	int rpm = (IDLE_RPM + current_speed * RPM_PER_MPH) * 4;
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = MODEL_BMW_X1_RPM_ID;
+	cf.len = 8;
+	cf.data[MODEL_BMW_X1_RPM_BYTE] = rpm & 0xff;
+	cf.data[MODEL_BMW_X1_RPM_BYTE + 1] = (rpm >> 8) & 0xff;
+	randomize_pkt(0, MODEL_BMW_X1_RPM_BYTE);
+	randomize_pkt(MODEL_BMW_X1_RPM_BYTE + 2, 8);
+	send_pkt(CAN_MTU);
+}
+
 void send_turn_signal() {
+	if (layout) {
+		send_packed(0);
+		return;
+	}
 	memset(&cf, 0, sizeof(cf));
 	cf.can_id = signal_id;
 	cf.len = signal_len;
@@ -264,6 +380,7 @@ void checkAccel() {
 			}
 		}
 		send_speed();
+		send_rpm();
 		lastAccel = currentTime;
 	}
 }
@@ -283,6 +400,101 @@ void checkTurn() {
 	}
 }
 
+// Steps the speed for the latency benchmark, returns 1 once all inputs went out
+int checkLatencyInput() {
+	if(currentTime < nextLatencyInput) return 0;
+	if(latency_sent == latency_inputs) return 1;
+	latency_seq++;
+	current_speed = (current_speed == LATENCY_LOW_MPH) ? LATENCY_HIGH_MPH : LATENCY_LOW_MPH;
+	send_speed();
+	latency_sent++;
+	nextLatencyInput = currentTime + LATENCY_INPUT_MS + rand() % 17;
+	if(latency_sent == latency_inputs) {
+		printf("Sent %d latency inputs\n", latency_sent);
+		nextLatencyInput = currentTime + 1000; // Let the last one reach the screen
+	}
+	return 0;
+}
+
+// Applies a scenario or command socket action
+void perform_action(const ScenarioAction *action) {
+	switch(action->op) {
+	case SCEN_THROTTLE:
+		throttle = action->value;
+		break;
+	case SCEN_TURN:
+		turning = action->value;
+		break;
+	case SCEN_LOCK:
+		send_lock(action->value);
+		break;
+	case SCEN_UNLOCK:
+		send_unlock(action->value);
+		break;
+	case SCEN_HANDBRAKE:
+		handbrake = action->value;
+		break;
+	case SCEN_FRAME:
+		cf = action->frame;
+		send_pkt(action->mtu);
+		break;
+	}
+}
+
+// Performs the scenario actions that are due (-S), returns 1 once it has finished
+int checkScenario() {
+	ScenarioAction action;
+	for(int i = 0; i < SCENARIO_BURST; i++) {
+		int ret = scenario_next(&scenario, currentTime, &action);
+		if(ret == SCEN_DONE) return 1;
+		if(ret == SCEN_PENDING) return 0;
+		perform_action(&action);
+	}
+	return 0;
+}
+
+// Runs one line from the command socket (-U), the scenario instructions plus a few extras
+int handle_command(char *line, char *reply, size_t len) {
+	char cmd[16] = "";
+	ScenarioAction action;
+
+	sscanf(line, "%15s", cmd);
+	if(!strcmp(cmd, "speed")) {
+		double mph;
+		char extra;
+		if(sscanf(line, "%*s %lf %c", &mph, &extra) != 1 || mph < 0 || mph > MAX_SPEED) {
+			snprintf(reply, len, "ERR speed must be 0-%.0f", MAX_SPEED);
+			return CMDSOCK_OK;
+		}
+		// Hold the new speed until the next throttle command
+		current_speed = mph;
+		throttle = 0;
+		send_speed();
+		send_rpm();
+	} else if(!strcmp(cmd, "state")) {
+		snprintf(reply, len, "OK speed=%.1f throttle=%d turn=%d doors=%X handbrake=%d frames=%ld",
+		         current_speed, throttle, turning, door_state & 0xf, handbrake, frames_sent);
+		return CMDSOCK_OK;
+	} else if(!strcmp(cmd, "ping")) {
+	} else if(!strcmp(cmd, "quit")) {
+		snprintf(reply, len, "OK bye");
+		return CMDSOCK_CLOSE;
+	} else if(!strcmp(cmd, "shutdown")) {
+		shutdown_requested = 1;
+	} else if(scenario_parse_action(&commands, line, &action) == 0) {
+		if(action.op == SCEN_FRAME && action.mtu == CANFD_MTU && can_mtu != CANFD_MTU) {
+			snprintf(reply, len, "ERR %s is not CAN FD capable", ifr.ifr_name);
+			return CMDSOCK_OK;
+		}
+		perform_action(&action);
+	} else {
+		snprintf(reply, len, "ERR invalid command '%s'", cmd);
+		return CMDSOCK_OK;
+	}
+	snprintf(reply, len, "OK");
+	return CMDSOCK_OK;
+}
+
 // Takes R2 joystick value and converts it to throttle speed
 void accelerate(int value) {
 	// Check dead zones
@@ -362,10 +574,9 @@ void kk_check(int k) {
 }
 
 // Plays background can traffic
+// Streams the log (plain, gzip or zstd) forever with its original timing, like canplayer -l i
 void play_can_traffic() {
-	char can2can[50];
-	snprintf(can2can, 49, "%s=can0", ifr.ifr_name);
-	if(execlp("canplayer", "canplayer", "-I", traffic_log, "-l", "i", can2can, NULL) == -1) printf("WARNING: Could not execute canplayer. No bg data\n");
+	if(logplay_run(traffic_log, s, "can0", 0, traffic_start) < 0) printf("WARNING: Could not replay %s. No bg data\n", traffic_log);
 }
 
 void kill_child() {
@@ -434,14 +645,64 @@ void print_joy_info() {
 	map_joy();
 }
 
+// Opens the window and the first joystick
+SDL_Window *init_gui() {
+  SDL_Window *window = NULL;
+  if(SDL_Init ( SDL_INIT_VIDEO | SDL_INIT_JOYSTICK ) < 0 ) {
+        printf("SDL Could not initializes\n");
+        exit(40);
+  }
+  if( SDL_NumJoysticks() < 1) {
+	printf(" Warning: No joysticks connected\n");
+  } else {
+	if(SDL_IsGameController(0)) {
+	  gGameController = SDL_GameControllerOpen(0);
+	  if(gGameController == NULL) {
+		printf(" Warning: Unable to open game controller. %s\n", SDL_GetError() );
+	  } else {
+		gJoystick = SDL_GameControllerGetJoystick(gGameController);
+		gHaptic = SDL_HapticOpenFromJoystick(gJoystick);
+		print_joy_info();
+	  }
+        } else {
+		gJoystick = SDL_JoystickOpen(0);
+		if(gJoystick == NULL) {
+			printf(" Warning: Could not open joystick\n");
+		} else {
+			gHaptic = SDL_HapticOpenFromJoystick(gJoystick);
+			if (gHaptic == NULL) printf("No Haptic support\n");
+			print_joy_info();
+		}
+	}
+  }
+  window = SDL_CreateWindow("CANBus Control Panel", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+  if(window == NULL) {
+        printf("Window could not be shown\n");
+  }
+  renderer = SDL_CreateRenderer(window, -1, 0);
+  base_texture = asset_texture(renderer, &asset_joypad);
+  SDL_RenderCopy(renderer, base_texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+  return window;
+}
+
 void usage(char *msg) {
   if(msg) printf("%s\n", msg);
   printf("Usage: controls [options] <can>\n");
   printf("\t-s\tseed value from IC\n");
   printf("\t-l\tdifficulty level. 0-2 (default: %d)\n", DEFAULT_DIFFICULTY);
-  printf("\t-t\ttraffic file to use for bg CAN traffic\n");
+  printf("\t-t\ttraffic file to use for bg CAN traffic, may be gzip or zstd compressed\n");
+  printf("\t-T\tstart the bg traffic [[HH:]MM:]SS into the log, then loop from the beginning\n");
   printf("\t-m\tModel (Ex: -m bmw)\n");
   printf("\t-X\tDisable background CAN traffic.  Cheating if doing RE but needed if playing on a real CANbus\n");
+  printf("\t-A\tpack door, turn signal and speed into one frame: classic, fd or fd-compact\n");
+  printf("\t-F\tsame as -A fd\n");
+  printf("\t-B\tprint the bus load of the frames sent every %d s\n", BUSLOAD_REPORT_MS / 1000);
+  printf("\t-L\tlatency benchmark: send N tagged speed steps for icsim -L, then quit\n");
+  printf("\t-S\trun the scenario FILE headless (no window or joystick), then quit\n");
+  printf("\t-U\trun headless, taking commands on the Unix socket PATH\n");
+  printf("\t-V\tvirtual clock: acceleration and turn signals run on simulated time\n");
+  printf("\t\twith -S the scenario runs as fast as possible\n");
   printf("\t-d\tdebug mode\n");
   exit(1);
 }
@@ -453,10 +714,12 @@ int main(int argc, char *argv[]) {
   int running = 1;
   int enable_canfd = 1;
   int play_traffic = 0; // Default to OFF
+  int virtual_clock = 0;
+  int scenario_done = 0;
   struct stat st;
   SDL_Event event;
 
-  while ((opt = getopt(argc, argv, "Xdl:s:t:m:h?")) != -1) {
+  while ((opt = getopt(argc, argv, "Xdl:s:t:T:m:VL:A:FBS:U:h?")) != -1) {
     switch(opt) {
 	case 'l':
 		difficulty = atoi(optarg);
@@ -468,6 +731,9 @@ int main(int argc, char *argv[]) {
 	case 't':
 		traffic_log = optarg;
 		break;
+	case 'T':
+		if (logindex_parse_offset(optarg, &traffic_start) < 0) usage("Start time must be [[HH:]MM:]SS");
+		break;
 	case 'd':
 		debug = 1;
 		break;
@@ -477,6 +743,28 @@ int main(int argc, char *argv[]) {
 	case 'X':
 		play_traffic = 0; // Explicitly disable traffic
 		break;
+	case 'V':
+		virtual_clock = 1;
+		break;
+	case 'L':
+		latency_inputs = atoi(optarg);
+		break;
+	case 'A':
+		layout = layout_find(optarg);
+		if (!layout) usage("Unknown layout, use classic, fd or fd-compact");
+		break;
+	case 'F':
+		layout = layout_find("fd");
+		break;
+	case 'B':
+		show_busload = 1;
+		break;
+	case 'S':
+		scenario_file = optarg;
+		break;
+	case 'U':
+		command_socket = optarg;
+		break;
 	case 'h':
 	case '?':
 	default:
@@ -486,6 +774,18 @@ int main(int argc, char *argv[]) {
   }
 
   if (optind >= argc) usage("You must specify at least one can device");
+  if (latency_inputs && virtual_clock) usage("The latency benchmark needs the real clock");
+  // Commands arrive in real time, a virtual clock would race ahead between them
+  if (command_socket && virtual_clock) usage("The command socket needs the real clock");
+  if (latency_inputs && layout) usage("The latency benchmark tags the single speed message, drop -A");
+  if (latency_inputs && (scenario_file || command_socket))
+	usage("The latency benchmark can not be combined with -S or -U");
+  headless = scenario_file || command_socket;
+  if (scenario_file && scenario_load(scenario_file, &scenario) < 0) {
+	printf("ERROR: Could not load scenario %s\n", scenario_file);
+	return 1;
+  }
+  clock_init(virtual_clock ? CLOCK_VIRTUAL : CLOCK_REAL);
 
   if(stat(traffic_log, &st) == -1) {
 	char msg[256];
@@ -514,6 +814,20 @@ int main(int argc, char *argv[]) {
        return 1;
   }
 
+  if ((layout && layout->fd) || (scenario_file && scenario_uses_fd(&scenario)) || command_socket) {
+       if (ioctl(s, SIOCGIFMTU, &ifr) < 0) {
+            perror("SIOCGIFMTU");
+            return 1;
+       }
+       can_mtu = ifr.ifr_mtu;
+       // The command socket only needs to know, FD frames sent to it are refused
+       if (can_mtu != CANFD_MTU && ((layout && layout->fd) || (scenario_file && scenario_uses_fd(&scenario)))) {
+            printf("%s is not CAN FD capable, %s %s needs an FD interface\n", ifr.ifr_name,
+                   layout && layout->fd ? "layout" : "scenario", layout && layout->fd ? layout->name : scenario_file);
+            return 1;
+       }
+  }
+
   if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
        perror("bind");
        return 1;
@@ -539,6 +853,7 @@ int main(int argc, char *argv[]) {
 	if (!strncmp(model, "bmw", 3)) {
 		speed_id = MODEL_BMW_X1_SPEED_ID;
 		speed_pos = MODEL_BMW_X1_SPEED_BYTE;
+		speed_len = MODEL_BMW_X1_HANDBRAKE_BYTE + 1;
 	} else {
 		printf("Invalid model.  Valid entries are: bmw\n");
 	}
@@ -575,48 +890,28 @@ int main(int argc, char *argv[]) {
 	atexit(kill_child);
   }
 
-  // GUI Setup
+  // GUI Setup, skipped when a scenario or the command socket drives the controls
   SDL_Window *window = NULL;
-  if(SDL_Init ( SDL_INIT_VIDEO | SDL_INIT_JOYSTICK ) < 0 ) {
-        printf("SDL Could not initializes\n");
-        exit(40);
-  }
-  if( SDL_NumJoysticks() < 1) {
-	printf(" Warning: No joysticks connected\n");
-  } else {
-	if(SDL_IsGameController(0)) {
-	  gGameController = SDL_GameControllerOpen(0);
-	  if(gGameController == NULL) {
-		printf(" Warning: Unable to open game controller. %s\n", SDL_GetError() );
-	  } else {
-		gJoystick = SDL_GameControllerGetJoystick(gGameController);
-		gHaptic = SDL_HapticOpenFromJoystick(gJoystick);
-		print_joy_info();
-	  }
-        } else {
-		gJoystick = SDL_JoystickOpen(0);
-		if(gJoystick == NULL) {
-			printf(" Warning: Could not open joystick\n");
-		} else {
-			gHaptic = SDL_HapticOpenFromJoystick(gJoystick);
-			if (gHaptic == NULL) printf("No Haptic support\n");
-			print_joy_info();
-		}
+  if (!headless) window = init_gui();
+
+  if (command_socket) {
+	if (cmdsock_open(&cmdsock, command_socket) < 0) {
+		printf("ERROR: Could not listen on %s\n", command_socket);
+		return 1;
 	}
+	scenario_start(&commands, 0);
+	printf("Listening for commands on %s\n", command_socket);
   }
-  window = SDL_CreateWindow("CANBus Control Panel", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-  if(window == NULL) {
-        printf("Window could not be shown\n");
+
+  if (scenario_file) {
+	printf("Running scenario %s (%d instructions)%s\n", scenario_file, scenario.nops,
+	       virtual_clock ? " on the virtual clock" : "");
+	scenario_start(&scenario, clock_ms());
   }
-  renderer = SDL_CreateRenderer(window, -1, 0);
-  SDL_Surface *image = IMG_Load(get_data("joypad.png"));
-  base_texture = SDL_CreateTextureFromSurface(renderer, image);
-  SDL_RenderCopy(renderer, base_texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
   int button, axis; // Used for checking dynamic joystick mappings
 
   while(running) {
-    while( SDL_PollEvent(&event) != 0 ) {
+    while( !headless && SDL_PollEvent(&event) != 0 ) {
         switch(event.type) {
             case SDL_QUIT:
                 running = 0;
@@ -676,6 +971,9 @@ int main(int argc, char *argv[]) {
 				send_unlock(CAN_DOOR4_LOCK);
 			}
 			break;
+		    case SDLK_h:
+			handbrake = !handbrake;
+			break;
 		}
 		kk_check(event.key.keysym.sym);
 	   	break;
@@ -800,15 +1098,49 @@ int main(int argc, char *argv[]) {
 		break;
         }
     }
-    currentTime = SDL_GetTicks();
+    currentTime = clock_ms();
     checkAccel();
     checkTurn();
-    SDL_Delay(5);
+    if (latency_inputs && checkLatencyInput()) running = 0;
+    if (scenario_file && !scenario_done && checkScenario()) {
+      // With a command socket the controls stay up after the scenario
+      scenario_done = 1;
+      if (!command_socket) running = 0;
+    }
+    if (shutdown_requested) running = 0;
+    if (layout && currentTime >= lastPacked + layout->cycle_ms) send_packed(1);
+    if (show_busload && currentTime >= lastBusload + BUSLOAD_REPORT_MS) {
+      busload_print(&busload, (currentTime - lastBusload) / 1000.0, CAN_BITRATE, CANFD_DATA_BITRATE);
+      busload_reset(&busload);
+      lastBusload = currentTime;
+    }
+    // Scenarios sleep until their next action when it is due sooner
+    int delay = 5;
+    if (scenario_file && !scenario_done) {
+      int until = (int)(scenario_deadline(&scenario) - clock_ms());
+      if (until < delay) delay = until > 0 ? until : 0;
+    }
+    if (command_socket) {
+      // Commands wake the loop as soon as they arrive
+      if (cmdsock_poll(&cmdsock, delay, handle_command) < 0) running = 0;
+    } else if (delay) {
+      clock_delay(delay);
+    }
   }
 
   close(s);
+  if (headless) {
+	if (scenario_file) {
+		printf("Scenario finished after %d ms, %ld frames sent\n", currentTime, frames_sent);
+		scenario_free(&scenario);
+	}
+	if (command_socket) {
+		printf("%ld commands handled, %ld frames sent\n", cmdsock.commands, frames_sent);
+		cmdsock_close(&cmdsock);
+	}
+	return 0;
+  }
   SDL_DestroyTexture(base_texture);
-  SDL_FreeSurface(image);
   SDL_GameControllerClose(gGameController);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
@@ -0,0 +1,326 @@
+/*
+ * DBC signal database for the instrument cluster simulator
+ *
+ * Understands the subset of the DBC format needed to describe cluster
+ * signals: BO_ messages and their SG_ signals (Intel/Motorola byte order,
+ * signed values, scale/offset and simple multiplexing).  Everything else in
+ * the file (CM_, VAL_, BA_, ...) is skipped.
+ *
+ * Each signal gets a precomputed word index, shift and mask when it is
+ * loaded so decoding a frame loads the payload into 64-bit words once and
+ * then extracts every signal with a shift and a mask.
+ */
+
+#include <endian.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbc.h"
+
+#define DBC_LINE_LEN 1024
+#define DBC_EXTENDED_ID 0x80000000U
+
+static int add_message(DbcDatabase *db, int *cap, const char *line) {
+  unsigned long id;
+  int dlc;
+  char name[DBC_NAME_LEN];
+
+  if (sscanf(line, "BO_ %lu %63[^: ] : %d", &id, name, &dlc) != 3) return -1;
+  if (dlc < 0 || dlc > CANFD_MAX_DLEN) return -1;
+
+  if (db->nmessages == *cap) {
+    int ncap = *cap ? *cap * 2 : 16;
+    DbcMessage *m = realloc(db->messages, ncap * sizeof(DbcMessage));
+    if (!m) return -1;
+    db->messages = m;
+    *cap = ncap;
+  }
+
+  DbcMessage *msg = &db->messages[db->nmessages++];
+  memset(msg, 0, sizeof(*msg));
+  if (id & DBC_EXTENDED_ID) {
+    msg->id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  } else {
+    msg->id = id & CAN_SFF_MASK;
+  }
+  snprintf(msg->name, sizeof(msg->name), "%s", name);
+  msg->dlc = dlc;
+  msg->mux_index = -1;
+  return 0;
+}
+
+/* Works out where a signal lives in the word-loaded payload */
+static int dbc_prepare_signal(DbcSignal *sig) {
+  int lsb, msb;
+
+  if (sig->length < 1 || sig->length > 64) return -1;
+
+  if (sig->little_endian) {
+    // Intel: little endian words, bit n of the payload is bit n%64 of word n/64
+    lsb = sig->start_bit;
+    msb = lsb + sig->length - 1;
+    if (msb >= CANFD_MAX_DLEN * 8) return -1;
+    sig->word = lsb / 64;
+    sig->shift = lsb % 64;
+    sig->spill = (msb / 64) != sig->word;
+    sig->spill_word = sig->word + 1;
+    sig->need_len = msb / 8 + 1;
+  } else {
+    // Motorola: big endian words, count bits from the MSB of byte 0
+    msb = (sig->start_bit / 8) * 8 + (7 - sig->start_bit % 8);
+    lsb = msb + sig->length - 1;
+    if (lsb >= CANFD_MAX_DLEN * 8) return -1;
+    sig->word = lsb / 64;
+    sig->shift = 63 - (lsb % 64);
+    sig->spill = (msb / 64) != sig->word;
+    sig->spill_word = sig->word - 1;
+    sig->need_len = lsb / 8 + 1;
+  }
+
+  sig->mask = (sig->length == 64) ? ~0ULL : ((1ULL << sig->length) - 1);
+  sig->sign_bit = 1ULL << (sig->length - 1);
+  return 0;
+}
+
+static int add_signal(DbcMessage *msg, int *cap, const char *line) {
+  DbcSignal sig;
+  char mux[16];
+  char order, sign;
+  const char *p;
+  int n = 0;
+
+  memset(&sig, 0, sizeof(sig));
+  sig.tag = -1;
+
+  if (sscanf(line, " SG_ %63s %n", sig.name, &n) != 1) return -1;
+  p = line + n;
+
+  // Optional multiplexer indicator before the colon
+  if (*p != ':') {
+    if (sscanf(p, "%15s %n", mux, &n) != 1) return -1;
+    if (!strcmp(mux, "M")) {
+      sig.mux = DBC_MUX_SWITCH;
+    } else if (mux[0] == 'm') {
+      sig.mux = DBC_MUX_MULTIPLEXED;
+      sig.mux_value = strtoul(mux + 1, NULL, 10);
+    }
+    p += n;
+  }
+  if (*p != ':') return -1;
+  p++;
+
+  int matched = sscanf(p, " %d|%d@%c%c ( %lf , %lf ) [ %lf | %lf ] \"%15[^\"]\"", &sig.start_bit,
+                       &sig.length, &order, &sign, &sig.factor, &sig.offset, &sig.min, &sig.max,
+                       sig.unit);
+  if (matched < 8) return -1;
+  if (order != '0' && order != '1') return -1;
+  if (sign != '+' && sign != '-') return -1;
+  sig.little_endian = (order == '1');
+  sig.is_signed = (sign == '-');
+
+  if (dbc_prepare_signal(&sig) < 0) return -1;
+
+  if (msg->nsignals == DBC_MAX_SIGNALS) return -1;
+  if (msg->nsignals == *cap) {
+    int ncap = *cap ? *cap * 2 : 8;
+    DbcSignal *s = realloc(msg->signals, ncap * sizeof(DbcSignal));
+    if (!s) return -1;
+    msg->signals = s;
+    *cap = ncap;
+  }
+  if (sig.mux == DBC_MUX_SWITCH) msg->mux_index = msg->nsignals;
+  msg->signals[msg->nsignals++] = sig;
+  return 0;
+}
+
+static int compare_messages(const void *a, const void *b) {
+  canid_t ia = ((const DbcMessage *)a)->id;
+  canid_t ib = ((const DbcMessage *)b)->id;
+  return (ia > ib) - (ia < ib);
+}
+
+/* Fills in the per message decode summary once all signals are known */
+static void finish_message(DbcMessage *msg) {
+  int len = msg->dlc;
+
+  for (int i = 0; i < msg->nsignals; i++) {
+    DbcSignal *sig = &msg->signals[i];
+    if (sig->need_len > len) len = sig->need_len;
+    if (sig->little_endian) {
+      msg->has_intel = 1;
+    } else {
+      msg->has_motorola = 1;
+    }
+  }
+  msg->nwords = (len + 7) / 8;
+}
+
+int dbc_parse(const char *text, DbcDatabase *db) {
+  char line[DBC_LINE_LEN];
+  int msg_cap = 0, sig_cap = 0;
+  int lineno = 0;
+  const char *p = text;
+
+  memset(db, 0, sizeof(*db));
+
+  while (*p) {
+    const char *eol = strchr(p, '\n');
+    size_t len = eol ? (size_t)(eol - p) : strlen(p);
+    size_t copy = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+
+    memcpy(line, p, copy);
+    line[copy] = '\0';
+    p += len + (eol ? 1 : 0);
+    lineno++;
+
+    const char *tok = line + strspn(line, " \t");
+    // Only BO_ and SG_ are parsed, other long lines (comments, value tables) are skipped whole
+    if (len != copy && (!strncmp(tok, "BO_ ", 4) || !strncmp(tok, "SG_ ", 4))) {
+      fprintf(stderr, "[DBC] Line %d is longer than %d characters\n", lineno, DBC_LINE_LEN - 1);
+      dbc_free(db);
+      return -1;
+    }
+    if (!strncmp(tok, "BO_ ", 4)) {
+      if (add_message(db, &msg_cap, tok) < 0) {
+        fprintf(stderr, "[DBC] Invalid message on line %d\n", lineno);
+        dbc_free(db);
+        return -1;
+      }
+      sig_cap = 0;
+    } else if (!strncmp(tok, "SG_ ", 4)) {
+      if (db->nmessages == 0) {
+        fprintf(stderr, "[DBC] Signal outside of a message on line %d\n", lineno);
+        dbc_free(db);
+        return -1;
+      }
+      if (add_signal(&db->messages[db->nmessages - 1], &sig_cap, tok) < 0) {
+        fprintf(stderr, "[DBC] Invalid signal on line %d\n", lineno);
+        dbc_free(db);
+        return -1;
+      }
+    }
+  }
+
+  for (int i = 0; i < db->nmessages; i++) finish_message(&db->messages[i]);
+  qsort(db->messages, db->nmessages, sizeof(DbcMessage), compare_messages);
+  return 0;
+}
+
+int dbc_load(const char *path, DbcDatabase *db) {
+  FILE *fp = fopen(path, "r");
+  long size;
+  char *text;
+  int ret;
+
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < 0) {
+    fclose(fp);
+    return -1;
+  }
+
+  text = malloc(size + 1);
+  if (!text) {
+    fclose(fp);
+    return -1;
+  }
+  size = fread(text, 1, size, fp);
+  text[size] = '\0';
+  fclose(fp);
+
+  ret = dbc_parse(text, db);
+  free(text);
+  return ret;
+}
+
+void dbc_free(DbcDatabase *db) {
+  for (int i = 0; i < db->nmessages; i++) free(db->messages[i].signals);
+  free(db->messages);
+  db->messages = NULL;
+  db->nmessages = 0;
+}
+
+const DbcMessage *dbc_find_message(const DbcDatabase *db, canid_t id) {
+  int lo = 0, hi = db->nmessages - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    canid_t mid_id = db->messages[mid].id;
+    if (mid_id == id) return &db->messages[mid];
+    if (mid_id < id) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+DbcSignal *dbc_find_signal(const DbcDatabase *db, const char *name, const DbcMessage **msg) {
+  for (int i = 0; i < db->nmessages; i++) {
+    for (int j = 0; j < db->messages[i].nsignals; j++) {
+      if (!strcmp(db->messages[i].signals[j].name, name)) {
+        if (msg) *msg = &db->messages[i];
+        return &db->messages[i].signals[j];
+      }
+    }
+  }
+  return NULL;
+}
+
+static inline uint64_t extract_raw(const DbcSignal *sig, const uint64_t *words) {
+  uint64_t v = words[sig->word] >> sig->shift;
+  if (sig->spill) v |= words[sig->spill_word] << (64 - sig->shift);
+  return v & sig->mask;
+}
+
+static inline double to_physical(const DbcSignal *sig, uint64_t raw) {
+  if (sig->is_signed) {
+    int64_t v = (int64_t)((raw ^ sig->sign_bit) - sig->sign_bit);
+    return v * sig->factor + sig->offset;
+  }
+  return raw * sig->factor + sig->offset;
+}
+
+int dbc_decode(const DbcMessage *msg, const struct canfd_frame *cf, double *values) {
+  uint64_t le[DBC_MAX_WORDS], be[DBC_MAX_WORDS];
+  uint8_t payload[CANFD_MAX_DLEN] __attribute__((aligned(8)));
+  int len = (cf->len > CANFD_MAX_DLEN) ? CANFD_MAX_DLEN : cf->len;
+  int bytes = msg->nwords * 8;
+  int decoded = 0;
+  int64_t mux_raw = -1;
+
+  // Load the payload into 64-bit words once, zero padded past len
+  memset(payload, 0, bytes);
+  memcpy(payload, cf->data, (len < bytes) ? len : bytes);
+  for (int i = 0; i < msg->nwords; i++) {
+    uint64_t w;
+    memcpy(&w, payload + i * 8, sizeof(w));
+    if (msg->has_intel) le[i] = le64toh(w);
+    if (msg->has_motorola) be[i] = be64toh(w);
+  }
+
+  if (msg->mux_index >= 0) {
+    const DbcSignal *sw = &msg->signals[msg->mux_index];
+    if (sw->need_len <= len) mux_raw = extract_raw(sw, sw->little_endian ? le : be);
+  }
+
+  for (int i = 0; i < msg->nsignals; i++) {
+    const DbcSignal *sig = &msg->signals[i];
+    if (sig->need_len > len ||
+        (sig->mux == DBC_MUX_MULTIPLEXED && (int64_t)sig->mux_value != mux_raw)) {
+      values[i] = NAN;
+      continue;
+    }
+    values[i] = to_physical(sig, extract_raw(sig, sig->little_endian ? le : be));
+    decoded++;
+  }
+  return decoded;
+}
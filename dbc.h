@@ -0,0 +1,80 @@
+#ifndef DBC_H
+#define DBC_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+#define DBC_NAME_LEN 64
+#define DBC_UNIT_LEN 16
+#define DBC_MAX_WORDS (CANFD_MAX_DLEN / 8) // 512 bit payload as 64-bit words
+#define DBC_MAX_SIGNALS 256                // Per message
+
+// Multiplexer role of a signal (SG_ name M / SG_ name m<value>)
+#define DBC_MUX_NONE 0
+#define DBC_MUX_SWITCH 1
+#define DBC_MUX_MULTIPLEXED 2
+
+/* === Structures === */
+
+typedef struct {
+  char name[DBC_NAME_LEN];
+  char unit[DBC_UNIT_LEN];
+  int start_bit;     // As written in the DBC (Motorola: MSB, Intel: LSB)
+  int length;        // 1..64 bits
+  int little_endian; // @1 = Intel, @0 = Motorola
+  int is_signed;     // '-' = signed, '+' = unsigned
+  double factor;
+  double offset;
+  double min;
+  double max;
+  int mux;            // DBC_MUX_*
+  uint32_t mux_value; // Valid when mux == DBC_MUX_MULTIPLEXED
+  int tag;            // Free for the application, -1 when unused
+
+  // Precomputed extraction, see dbc_prepare_signal()
+  uint8_t word;      // Word holding the signal LSB
+  uint8_t shift;     // Right shift of the LSB within that word
+  uint8_t spill;     // Remaining bits live in the neighbouring word
+  uint8_t spill_word;
+  uint8_t need_len;  // Payload bytes required to hold the signal
+  uint64_t mask;
+  uint64_t sign_bit;
+} DbcSignal;
+
+typedef struct {
+  canid_t id; // CAN_EFF_FLAG set for extended identifiers
+  char name[DBC_NAME_LEN];
+  int dlc;    // Payload length in bytes (up to 64 for CAN FD)
+  int nwords; // 64-bit words covering the payload
+  int has_intel;
+  int has_motorola;
+  int mux_index; // Index of the multiplexer switch signal or -1
+  int nsignals;
+  DbcSignal *signals;
+} DbcMessage;
+
+typedef struct {
+  int nmessages;
+  DbcMessage *messages; // Sorted by id
+} DbcDatabase;
+
+/* === Prototypes === */
+
+// Loading. Both return 0 on success and -1 on error (reported on stderr)
+int dbc_load(const char *path, DbcDatabase *db);
+int dbc_parse(const char *text, DbcDatabase *db);
+void dbc_free(DbcDatabase *db);
+
+// Lookup
+const DbcMessage *dbc_find_message(const DbcDatabase *db, canid_t id);
+DbcSignal *dbc_find_signal(const DbcDatabase *db, const char *name, const DbcMessage **msg);
+
+// Decoding. Extracts every signal of msg in one pass over the payload.
+// values[i] receives the physical value of msg->signals[i] or NAN when the
+// signal is not present in this frame (inactive multiplex / short frame).
+// Returns the number of signals decoded.
+int dbc_decode(const DbcMessage *msg, const struct canfd_frame *cf, double *values);
+
+#endif // DBC_H
@@ -0,0 +1,443 @@
+/*
+ * CAN frame decoding for the instrument cluster
+ *
+ * Everything that turns received frames into CarState changes lives here,
+ * independent of the socket and the window, so the same code drives the live
+ * cluster (icsim) and offline replays of candump logs (icreplay).
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <linux/can.h>
+
+#include "icsim.h"
+#include "clock.h"
+
+int debug = 0;
+// Decoder configuration.  decode_frame() and decode_wants() read it without locking, so it
+// is set before any decoder thread starts and never changed while frames are decoded
+int door_pos = DEFAULT_DOOR_BYTE;
+int signal_pos = DEFAULT_SIGNAL_BYTE;
+int speed_pos = DEFAULT_SPEED_BYTE;
+char *model = NULL;
+canid_t door_id = DEFAULT_DOOR_ID;
+canid_t signal_id = DEFAULT_SIGNAL_ID;
+canid_t speed_id = DEFAULT_SPEED_ID;
+DbcDatabase *active_dbc = NULL;
+
+// Global car state
+CarState car_state;
+
+// Security context for UDS Security Access
+SecurityContext sec_ctx = {
+  .state = SEC_STATE_LOCKED_NO_SEED,
+  .seed = 0,
+  .seed_sent_time = 0,
+  .timeout_ms = 10000, // 10 seconds
+  .tokens = UDS_RESPONSE_BURST * 1000
+};
+
+// Sessions of the physically addressed testers 1..7, tester 0 uses sec_ctx
+static SecurityContext tester_ctx[UDS_TESTERS - 1];
+
+// DBC signal names, indexed by SIG_*
+const char *dbc_signal_names[SIG_COUNT] = {
+  "VehicleSpeed",
+  "TurnSignalLeft",
+  "TurnSignalRight",
+  "DoorLockFL",
+  "DoorLockFR",
+  "DoorLockRL",
+  "DoorLockRR",
+  "EngineSpeed",
+  "Handbrake"
+};
+
+/* Default vehicle state */
+void init_car_state() {
+  car_state.speed = 0;
+  car_state.rpm = 0;
+  car_state.door_status[0] = DOOR_LOCKED;
+  car_state.door_status[1] = DOOR_LOCKED;
+  car_state.door_status[2] = DOOR_LOCKED;
+  car_state.door_status[3] = DOOR_LOCKED;
+  car_state.turn_status[0] = OFF;
+  car_state.turn_status[1] = OFF;
+  car_state.handbrake = OFF;
+  car_state.lock_status = ON;
+  car_state.bus_load = 0;
+  for (int i = 0; i < UDS_TESTERS - 1; i++) {
+    tester_ctx[i] = sec_ctx;
+    tester_ctx[i].state = SEC_STATE_LOCKED_NO_SEED;
+  }
+}
+
+
+/* Decodes the two speed bytes at p */
+static void apply_speed(const Uint8 *p) {
+  if (model) {
+	  if (!strncmp(model, "bmw", 3)) {
+		  car_state.speed = (((p[1] - 208) * 256) + p[0]) / 16;
+	  }
+  } else {
+	  int speed = p[0] << 8;
+	  speed += p[1];
+	  speed = speed / 100; // speed in kilometers
+	  car_state.speed = speed * 0.6213751; // mph
+  }
+}
+
+static void apply_signals(Uint8 b) {
+  car_state.turn_status[0] = (b & CAN_LEFT_SIGNAL) ? ON : OFF;
+  car_state.turn_status[1] = (b & CAN_RIGHT_SIGNAL) ? ON : OFF;
+}
+
+static void apply_doors(Uint8 b) {
+  car_state.door_status[0] = (b & CAN_DOOR1_LOCK) ? DOOR_LOCKED : DOOR_UNLOCKED;
+  car_state.door_status[1] = (b & CAN_DOOR2_LOCK) ? DOOR_LOCKED : DOOR_UNLOCKED;
+  car_state.door_status[2] = (b & CAN_DOOR3_LOCK) ? DOOR_LOCKED : DOOR_UNLOCKED;
+  car_state.door_status[3] = (b & CAN_DOOR4_LOCK) ? DOOR_LOCKED : DOOR_UNLOCKED;
+}
+
+/* Parses CAN fram and updates current_speed */
+void update_speed_status(struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < speed_pos + 2) return;
+  apply_speed(&cf->data[speed_pos]);
+}
+
+/* Parses CAN frame and updates engine speed */
+void update_rpm_status(struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < MODEL_BMW_X1_RPM_BYTE + 2) return;
+  car_state.rpm = ((cf->data[MODEL_BMW_X1_RPM_BYTE + 1] << 8) + cf->data[MODEL_BMW_X1_RPM_BYTE]) / 4;
+}
+
+/* Parses CAN frame and updates handbrake status */
+void update_handbrake_status(struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < MODEL_BMW_X1_HANDBRAKE_BYTE + 1) return;
+  if(cf->data[MODEL_BMW_X1_HANDBRAKE_BYTE] & MODEL_BMW_X1_HANDBRAKE_BIT) {
+    car_state.handbrake = ON;
+  } else {
+    car_state.handbrake = OFF;
+  }
+}
+
+/* Parses CAN frame and updates turn signal status */
+void update_signal_status(struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < signal_pos + 1) return;
+  apply_signals(cf->data[signal_pos]);
+}
+
+/* Parses CAN frame and updates door status */
+void update_door_status(struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < door_pos + 1) return;
+  apply_doors(cf->data[door_pos]);
+}
+
+/* Parses a frame with packed signals (controls -A), see layout.h */
+void update_layout_status(const FrameLayout *layout, struct canfd_frame *cf, int maxdlen) {
+  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
+  if(len < layout->len) return;
+  apply_doors(cf->data[layout->pos[LAYOUT_DOOR]]);
+  apply_signals(cf->data[layout->pos[LAYOUT_SIGNAL]]);
+  apply_speed(&cf->data[layout->pos[LAYOUT_SPEED]]);
+}
+
+/* Tags the DBC signals icsim knows about, returns the number bound */
+int bind_dbc_signals(DbcDatabase *db) {
+  int bound = 0;
+  for (int i = 0; i < SIG_COUNT; i++) {
+    DbcSignal *sig = dbc_find_signal(db, dbc_signal_names[i], NULL);
+    if (!sig) {
+      if (debug) printf("[DBC] Signal %s not defined\n", dbc_signal_names[i]);
+      continue;
+    }
+    sig->tag = i;
+    bound++;
+  }
+  return bound;
+}
+
+/* Decodes every signal of a DBC message and updates the car state */
+void update_dbc_status(const DbcMessage *msg, struct canfd_frame *cf) {
+  double values[DBC_MAX_SIGNALS];
+  if (dbc_decode(msg, cf, values) == 0) return;
+  for (int i = 0; i < msg->nsignals; i++) {
+    int tag = msg->signals[i].tag;
+    double v = values[i];
+    if (tag < 0 || isnan(v)) continue;
+    switch (tag) {
+    case SIG_SPEED:
+      car_state.speed = v;
+      break;
+    case SIG_TURN_LEFT:
+    case SIG_TURN_RIGHT:
+      car_state.turn_status[tag - SIG_TURN_LEFT] = (v != 0) ? ON : OFF;
+      break;
+    case SIG_DOOR_FL:
+    case SIG_DOOR_FR:
+    case SIG_DOOR_RL:
+    case SIG_DOOR_RR:
+      car_state.door_status[tag - SIG_DOOR_FL] = (v != 0) ? DOOR_LOCKED : DOOR_UNLOCKED;
+      break;
+    case SIG_RPM:
+      car_state.rpm = v;
+      break;
+    case SIG_HANDBRAKE:
+      car_state.handbrake = (v != 0) ? ON : OFF;
+      break;
+    }
+  }
+}
+
+/* Routes a received frame to its decoders. Caller holds the state lock */
+void decode_frame(struct canfd_frame *cf, int maxdlen, int can_fd) {
+  if (active_dbc) {
+    const DbcMessage *dbc_msg = dbc_find_message(active_dbc, cf->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+    if (dbc_msg) update_dbc_status(dbc_msg, cf);
+  } else {
+    if (cf->can_id == door_id) update_door_status(cf, maxdlen);
+    if (cf->can_id == signal_id) update_signal_status(cf, maxdlen);
+    if (cf->can_id == speed_id) update_speed_status(cf, maxdlen);
+    const FrameLayout *layout = layout_by_id(cf->can_id);
+    if (layout) update_layout_status(layout, cf, maxdlen);
+    if (model && !strncmp(model, "bmw", 3)) {
+      if (cf->can_id == MODEL_BMW_X1_RPM_ID) update_rpm_status(cf, maxdlen);
+      if (cf->can_id == MODEL_BMW_X1_HANDBRAKE_ID) update_handbrake_status(cf, maxdlen);
+    }
+  }
+  int tester = uds_tester(cf->can_id);
+  if (tester >= 0)
+    update_security_status(cf, maxdlen, can_fd, tester ? &tester_ctx[tester - 1] : &sec_ctx);
+}
+
+/* Returns 1 when decode_frame() would look at frames with this ID */
+int decode_wants(canid_t id) {
+  if (uds_tester(id) >= 0) return 1;
+  if (active_dbc) return dbc_find_message(active_dbc, id & (CAN_EFF_FLAG | CAN_EFF_MASK)) != NULL;
+  if (id == door_id || id == signal_id || id == speed_id || layout_by_id(id)) return 1;
+  if (model && !strncmp(model, "bmw", 3))
+    return id == MODEL_BMW_X1_RPM_ID || id == MODEL_BMW_X1_HANDBRAKE_ID;
+  return 0;
+}
+
+/* Relocks the cluster once it has been unlocked for too long, returns 1 when it did */
+int check_auto_lock(Uint32 now) {
+  if (car_state.lock_status == OFF && now - car_state.unlock_time > AUTO_LOCK_MS) {
+    car_state.lock_status = ON;
+    return 1;
+  }
+  return 0;
+}
+
+/* Responses are dropped when there is no socket (offline replay) */
+int send_can_response(uint32_t can_id, uint8_t* data, uint8_t len, int can_fd) {
+    struct can_frame resp;
+    if (can_fd < 0) return 0;
+    memset(&resp, 0, sizeof(resp));
+    resp.can_id = can_id;
+    resp.can_dlc = len;
+    memcpy(resp.data, data, len);
+
+    // Never block the decode thread on a full TX queue, the tester will retry
+    ssize_t n = send(can_fd, &resp, sizeof(resp), MSG_DONTWAIT);
+    if (n < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        perror("[ERROR] write failed");
+    }
+    return n;
+}
+
+int send_canfd_response(uint32_t can_id, uint8_t* data, uint8_t len, uint8_t flags, int can_fd) {
+    if (len > CANFD_MAX_DLEN) {
+        fprintf(stderr, "[ERROR] CAN FD payload too large (%d bytes)\n", len);
+        return -1;
+    }
+    if (can_fd < 0) return 0;
+
+    struct canfd_frame frame;
+    memset(&frame, 0, sizeof(frame));
+
+    frame.can_id = can_id;
+    frame.len = len;  // CAN FDでは .len を使用
+    frame.flags = flags;
+    memcpy(frame.data, data, len);
+
+    ssize_t n = send(can_fd, &frame, CANFD_MTU, MSG_DONTWAIT);
+    if (n < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        perror("[ERROR] CAN FD write failed");
+    }
+    return n;
+}
+
+/* Answers in the format of the request: CAN FD (keeping its bit rate switch) or classic */
+static int send_uds_response(struct canfd_frame *resp, struct canfd_frame *req, int maxdlen, int can_fd) {
+  if (maxdlen == CANFD_MAX_DLEN)
+    return send_canfd_response(resp->can_id, resp->data, resp->len, req->flags & CANFD_BRS, can_fd);
+  return send_can_response(resp->can_id, resp->data, resp->len, can_fd);
+}
+
+// UDS Security Access simulation
+#define EXPECTED_KEY 0x5A
+
+/* Token bucket per tester, returns 0 when the request must be ignored */
+static int take_response_token(SecurityContext *ctx, Uint32 now) {
+  Uint32 elapsed = now - ctx->refill_time;
+
+  // Tokens are counted in thousandths so a millisecond refills UDS_RESPONSE_RATE of them
+  if (elapsed) {
+    Uint32 add = (elapsed > UDS_RESPONSE_BURST * 1000U / UDS_RESPONSE_RATE)
+                     ? UDS_RESPONSE_BURST * 1000U
+                     : elapsed * UDS_RESPONSE_RATE;
+    ctx->tokens = (ctx->tokens + add > UDS_RESPONSE_BURST * 1000U) ? UDS_RESPONSE_BURST * 1000U
+                                                                    : ctx->tokens + add;
+    ctx->refill_time = now;
+  }
+  if (ctx->tokens < 1000) {
+    ctx->dropped++;
+    return 0;
+  }
+  ctx->tokens -= 1000;
+  return 1;
+}
+
+static void send_nrc(struct canfd_frame *resp, struct canfd_frame *req, int maxdlen, int can_fd, Uint8 nrc) {
+  resp->len = 3;
+  resp->data[0] = UDS_NEGATIVE_RESPONSE;
+  resp->data[1] = UDS_SECURITY_REQ;
+  resp->data[2] = nrc;
+  send_uds_response(resp, req, maxdlen, can_fd);
+}
+
+/*
+ * Runs with the state mutex held in the decode thread, so a flood of requests
+ * must stay cheap: requests over the tester's response rate are dropped
+ * before any other work, and nothing is printed outside of debug mode.
+ */
+void update_security_status(struct canfd_frame *cf, int maxdlen, int can_fd, SecurityContext* ctx) {
+  if (cf->len < 2 || cf->data[0] != UDS_SECURITY_REQ) return;
+
+  Uint8 subfn = cf->data[1];
+  Uint32 now = clock_ms();
+
+  if (!take_response_token(ctx, now)) return;
+
+  struct canfd_frame resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.can_id = UDS_RESP_ID + uds_tester(cf->can_id);
+
+  if (subfn == UDS_SECURITY_REQ_SEED) {
+    // After too many invalid keys no seed is handed out until the delay timer expires
+    if ((Sint32)(ctx->delay_until - now) > 0) {
+      send_nrc(&resp, cf, maxdlen, can_fd, UDS_NRC_DELAY_NOT_EXPIRED);
+      if (debug) printf("[UDS] Seed refused, delay timer running\n");
+      return;
+    }
+
+    ctx->seed = generate_seed();
+    ctx->seed_sent_time = now;
+
+    // 状態遷移
+    if (ctx->state == SEC_STATE_LOCKED_NO_SEED)
+      ctx->state = SEC_STATE_LOCKED_WAIT_KEY;
+    else if (ctx->state == SEC_STATE_UNLOCKED_NO_SEED)
+      ctx->state = SEC_STATE_UNLOCKED_WAIT_KEY;
+
+    resp.len = 6;
+    resp.data[0] = UDS_SECURITY_REQ + UDS_POSITIVE_RESPONSE;
+    resp.data[1] = subfn;
+    resp.data[2] = ctx->seed;
+    resp.data[3] = ctx->seed;
+    resp.data[4] = ctx->seed;
+    resp.data[5] = 0x00;
+
+    send_uds_response(&resp, cf, maxdlen, can_fd);
+    if (debug) printf("[UDS] Sent seed: 0x%02X (subfn: 0x%02X, state: %d)\n", ctx->seed, subfn, ctx->state);
+  }
+
+  else if (subfn == UDS_SECURITY_REQ_KEY) {
+    // A key needs an outstanding seed, an expired one included
+    if (ctx->state != SEC_STATE_LOCKED_WAIT_KEY && ctx->state != SEC_STATE_UNLOCKED_WAIT_KEY) {
+      send_nrc(&resp, cf, maxdlen, can_fd, UDS_NRC_SEQUENCE_ERROR);
+      if (debug) printf("[UDS] Key received in invalid state\n");
+      return;
+    }
+
+    if (now - ctx->seed_sent_time > ctx->timeout_ms) {
+      ctx->state = SEC_STATE_LOCKED_NO_SEED;
+      send_nrc(&resp, cf, maxdlen, can_fd, UDS_NRC_SEQUENCE_ERROR);
+      if (debug) printf("[UDS] Timeout\n");
+      return;
+    }
+
+    if (cf->len < 5) return; // SID, SubFn, key[0], key[1], key[2]
+
+    Uint8 recv_key[3] = {cf->data[2], cf->data[3], cf->data[4]};
+    Uint8 expected_key[3];
+    calculate_key(ctx->seed, expected_key);
+
+    if (recv_key[0] == expected_key[0] &&
+        recv_key[1] == expected_key[1] &&
+        recv_key[2] == expected_key[2]) {
+
+      car_state.lock_status = OFF;
+      car_state.unlock_time = clock_ms();
+      ctx->seed = 0;
+      ctx->state = SEC_STATE_UNLOCKED_NO_SEED;
+      ctx->attempts = 0;
+
+      resp.len = 2;
+      resp.data[0] = UDS_SECURITY_REQ + UDS_POSITIVE_RESPONSE;
+      resp.data[1] = subfn;
+      send_uds_response(&resp, cf, maxdlen, can_fd);
+      if (debug) printf("[UDS] Key correct. Unlocked.\n");
+
+    } else {
+      car_state.lock_status = ON;
+      ctx->seed = 0;
+      ctx->state = SEC_STATE_LOCKED_NO_SEED;
+
+      // ISO 14229 attempt counter: the last allowed failure starts the delay timer
+      if (++ctx->attempts >= UDS_MAX_ATTEMPTS) {
+        ctx->attempts = 0;
+        ctx->delay_until = now + UDS_ATTEMPT_DELAY_MS;
+        ctx->lockouts++;
+        send_nrc(&resp, cf, maxdlen, can_fd, UDS_NRC_EXCEEDED_ATTEMPTS);
+      } else {
+        send_nrc(&resp, cf, maxdlen, can_fd, UDS_NRC_INVALID_KEY);
+      }
+      if (debug)
+        printf("[UDS] Invalid key: %02X %02X %02X (expected: %02X %02X %02X)\n",
+               recv_key[0], recv_key[1], recv_key[2],
+               expected_key[0], expected_key[1], expected_key[2]);
+    }
+  }
+}
+
+/* xorshift32 seeded from rand(), so icsim -s still decides the sequence */
+Uint8 generate_seed() {
+  static Uint32 x = 0;
+  if (!x) x = (Uint32)rand() | 1;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x >> 24;
+}
+
+/* Per tester SecurityAccess counters, for the debug summary */
+void print_security_stats() {
+  for (int i = 0; i < UDS_TESTERS; i++) {
+    const SecurityContext *ctx = i ? &tester_ctx[i - 1] : &sec_ctx;
+    if (ctx->dropped || ctx->lockouts)
+      printf("[UDS] Tester 0x%03X: %lu requests over the rate limit dropped, %lu lockouts\n",
+             UDS_PHYS_REQ_ID + i, ctx->dropped, ctx->lockouts);
+  }
+}
+
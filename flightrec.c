@@ -0,0 +1,152 @@
+/*
+ * Flight recorder for received CAN frames
+ *
+ * Keeps the last few seconds of traffic in a pre-allocated ring so the
+ * frames that led to a wrong display can be dumped after the fact, either
+ * as a candump log (replayable with canplayer) or in a binary format.
+ * Formatting a full ring takes seconds, so icsim dumps on a detached thread.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flightrec.h"
+#include "lib.h"
+
+/* Allocates and pre-faults the ring for the given window. Returns 0 on success */
+int flightrec_init(FlightRecorder *fr, unsigned seconds, const char *ifname) {
+  uint64_t want = (uint64_t)seconds * FLIGHTREC_FRAME_RATE;
+  uint64_t capacity = 1;
+
+  while (capacity < want) capacity <<= 1;
+
+  memset(fr, 0, sizeof(*fr));
+  fr->slots = malloc(capacity * sizeof(FlightRecord));
+  if (!fr->slots) return -1;
+  // Touch every page now so recording never takes a page fault
+  memset(fr->slots, 0, capacity * sizeof(FlightRecord));
+  fr->mask = capacity - 1;
+  fr->seconds = seconds;
+  snprintf(fr->ifname, sizeof(fr->ifname), "%s", ifname);
+  atomic_init(&fr->head, 0);
+  atomic_init(&fr->dumping, 0);
+  return 0;
+}
+
+void flightrec_free(FlightRecorder *fr) {
+  struct timespec wait = {0, 10000000};
+
+  // A dump still reads the ring
+  while (atomic_load(&fr->dumping)) nanosleep(&wait, NULL);
+  free(fr->slots);
+  fr->slots = NULL;
+}
+
+static int older_than(const struct timeval *ts, const struct timeval *limit) {
+  return ts->tv_sec < limit->tv_sec || (ts->tv_sec == limit->tv_sec && ts->tv_usec < limit->tv_usec);
+}
+
+/* Writes the recorded window to path, returns the number of frames or -1 */
+long flightrec_dump(FlightRecorder *fr, const char *path, int binary) {
+  uint64_t capacity = fr->mask + 1;
+  uint64_t head = atomic_load_explicit(&fr->head, memory_order_acquire);
+  uint64_t first = (head > capacity) ? head - capacity : 0;
+  uint64_t count = head - first;
+  FlightRecord *copy;
+  FILE *fp;
+  char buf[CL_CFSZ];
+  long written = 0;
+
+  if (count == 0) return 0;
+  copy = malloc(count * sizeof(FlightRecord));
+  if (!copy) return -1;
+  for (uint64_t i = 0; i < count; i++) copy[i] = fr->slots[(first + i) & fr->mask];
+
+  // Slots the producer reached while we were copying are no longer valid
+  uint64_t after = atomic_load_explicit(&fr->head, memory_order_acquire);
+  uint64_t valid = (after + 1 > capacity) ? after + 1 - capacity : 0;
+  uint64_t skip = (valid > first) ? valid - first : 0;
+  if (skip > count) skip = count;
+
+  // Only keep the configured window before the newest frame
+  struct timeval limit = copy[count - 1].ts;
+  limit.tv_sec -= fr->seconds;
+
+  fp = fopen(path, binary ? "wb" : "w");
+  if (!fp) {
+    perror(path);
+    free(copy);
+    return -1;
+  }
+  if (binary) {
+    uint32_t record_size = sizeof(FlightRecord);
+    fwrite(FLIGHTREC_MAGIC, 1, strlen(FLIGHTREC_MAGIC), fp);
+    fwrite(&record_size, sizeof(record_size), 1, fp);
+  }
+  for (uint64_t i = skip; i < count; i++) {
+    FlightRecord *rec = &copy[i];
+    if (older_than(&rec->ts, &limit)) continue;
+    if (binary) {
+      fwrite(rec, sizeof(*rec), 1, fp);
+    } else {
+      sprint_canframe(buf, &rec->frame, 0,
+                      (rec->mtu == CANFD_MTU) ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+      fprintf(fp, "(%010ld.%06ld) %s %s\n", (long)rec->ts.tv_sec, (long)rec->ts.tv_usec,
+              fr->ifname, buf);
+    }
+    written++;
+  }
+  fclose(fp);
+  free(copy);
+  return written;
+}
+
+typedef struct {
+  FlightRecorder *fr;
+  int binary;
+  char path[]; // Copied, the caller's string may not outlive the dump
+} DumpJob;
+
+static void *dump_thread(void *arg) {
+  DumpJob *job = arg;
+  long n = flightrec_dump(job->fr, job->path, job->binary);
+
+  if (n >= 0) {
+    printf("[FLIGHTREC] Wrote %ld frames to %s\n", n, job->path);
+  } else {
+    printf("WARNING: Could not write the flight recorder dump %s\n", job->path);
+  }
+  atomic_store(&job->fr->dumping, 0);
+  free(job);
+  return NULL;
+}
+
+int flightrec_dump_async(FlightRecorder *fr, const char *path, int binary) {
+  pthread_attr_t attr;
+  pthread_t thread;
+  DumpJob *job;
+  int expected = 0;
+
+  if (!atomic_compare_exchange_strong(&fr->dumping, &expected, 1)) return 1;
+  job = malloc(sizeof(*job) + strlen(path) + 1);
+  if (!job) {
+    atomic_store(&fr->dumping, 0);
+    return -1;
+  }
+  job->fr = fr;
+  job->binary = binary;
+  strcpy(job->path, path);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&thread, &attr, dump_thread, job);
+  pthread_attr_destroy(&attr);
+  if (err) {
+    free(job);
+    atomic_store(&fr->dumping, 0);
+    return -1;
+  }
+  return 0;
+}
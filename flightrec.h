@@ -0,0 +1,58 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <linux/can.h>
+#include <net/if.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* === Constants === */
+
+#define FLIGHTREC_FRAME_RATE 10000 // Frames/sec the ring is sized for
+#define FLIGHTREC_MAGIC "ICSIMFR1" // Binary dump header
+#define FLIGHTREC_PREFETCH 8       // Slots ahead to prefetch
+
+/* === Structures === */
+
+typedef struct {
+  struct timeval ts; // Kernel receive timestamp
+  int mtu;           // CAN_MTU or CANFD_MTU
+  struct canfd_frame frame;
+} FlightRecord;
+
+// Single producer ring of the most recent frames. The decode thread records,
+// any other thread may dump concurrently without stopping it.
+typedef struct {
+  FlightRecord *slots;
+  uint64_t mask;             // Capacity - 1, capacity is a power of two
+  _Atomic uint64_t head;     // Frames recorded so far
+  unsigned seconds;          // Window written by flightrec_dump()
+  _Atomic int dumping;       // A flightrec_dump_async() writer is running
+  char ifname[IFNAMSIZ + 1]; // Interface name for candump output
+} FlightRecorder;
+
+/* === Prototypes === */
+
+int flightrec_init(FlightRecorder *fr, unsigned seconds, const char *ifname);
+void flightrec_free(FlightRecorder *fr);
+long flightrec_dump(FlightRecorder *fr, const char *path, int binary);
+// Dumps on a detached thread that prints the result. Returns 1 while a dump is still running
+int flightrec_dump_async(FlightRecorder *fr, const char *path, int binary);
+
+/* Records a received frame. No allocation, no locking */
+static inline void flightrec_record(FlightRecorder *fr, const struct canfd_frame *cf, int mtu,
+                                    const struct timeval *ts) {
+  uint64_t head = atomic_load_explicit(&fr->head, memory_order_relaxed);
+  FlightRecord *rec = &fr->slots[head & fr->mask];
+
+  rec->ts = *ts;
+  rec->mtu = mtu;
+  rec->frame = *cf;
+  atomic_store_explicit(&fr->head, head + 1, memory_order_release);
+  // Pull a later slot into cache so the next frames do not wait on memory
+  __builtin_prefetch(&fr->slots[(head + FLIGHTREC_PREFETCH) & fr->mask], 1);
+}
+
+#endif // FLIGHTREC_H
@@ -0,0 +1,234 @@
+/*
+ * Gauge widgets for the instrument cluster
+ *
+ * Every gauge owns a damage region and a cached static layer holding the
+ * background (plus any decoration such as a bar track) for that region.
+ * Only gauges whose displayed position changed are redrawn, so the per frame
+ * cost follows what changed on the bus rather than how many gauges exist.
+ *
+ * Gauges are drawn into the current render target.  Overlapping gauges are
+ * redrawn together, clipped to the damaged region, in table order.
+ *
+ * The table is laid out in fractions of the cluster size, and sprite areas in
+ * fractions of their texture, so it holds for any output size and for artwork
+ * at any resolution.  gauge_init() maps it to the output size and resamples
+ * every texture a gauge draws to its final size, so drawing never scales and a
+ * resize costs one rebuild.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "assets.h"
+#include "gauge.h"
+
+static double source_value(const CarState *state, int source) {
+  switch (source) {
+  case GAUGE_SRC_SPEED:
+    return state->speed;
+  case GAUGE_SRC_RPM:
+    return state->rpm;
+  case GAUGE_SRC_TURN_LEFT:
+    return state->turn_status[0] == ON;
+  case GAUGE_SRC_TURN_RIGHT:
+    return state->turn_status[1] == ON;
+  case GAUGE_SRC_DOOR_FL:
+  case GAUGE_SRC_DOOR_FR:
+  case GAUGE_SRC_DOOR_RL:
+  case GAUGE_SRC_DOOR_RR:
+    return state->door_status[source - GAUGE_SRC_DOOR_FL] == DOOR_UNLOCKED;
+  case GAUGE_SRC_ANY_DOOR:
+    for (int i = 0; i < 4; i++)
+      if (state->door_status[i] == DOOR_UNLOCKED) return 1;
+    return 0;
+  case GAUGE_SRC_HANDBRAKE:
+    return state->handbrake == ON;
+  case GAUGE_SRC_LOCKED:
+    return state->lock_status == ON;
+  case GAUGE_SRC_BUS_LOAD:
+    return state->bus_load;
+  }
+  return 0;
+}
+
+/* Maps a value to one of the gauge positions */
+static int quantize(const Gauge *g, double value) {
+  if (g->type == GAUGE_TELLTALE) return value != 0;
+  int pos = (int)lround((value - g->min) * g->steps / (g->max - g->min));
+  if (pos < 0) pos = 0;
+  if (pos > g->steps) pos = g->steps;
+  return pos;
+}
+
+/* Maps both edges rather than the size, so gauges that touch keep touching */
+static SDL_Rect pixel_rect(const GaugeRect *rc, int w, int h) {
+  int x0 = (int)lround(rc->x * w), y0 = (int)lround(rc->y * h);
+  int x1 = (int)lround((rc->x + rc->w) * w), y1 = (int)lround((rc->y + rc->h) * h);
+  SDL_Rect out = {x0, y0, x1 - x0, y1 - y0};
+  return out;
+}
+
+/* Resamples the sprite area of tex to the size of the gauge */
+static SDL_Texture *gauge_image(SDL_Renderer *r, const Gauge *g, SDL_Texture *tex) {
+  SDL_Rect src;
+  int w = 0, h = 0;
+
+  if (!g->src.w) return asset_scale(r, tex, NULL, g->view.w, g->view.h);
+  SDL_QueryTexture(tex, NULL, NULL, &w, &h);
+  src = pixel_rect(&g->src, w, h);
+  return asset_scale(r, tex, &src, g->view.w, g->view.h);
+}
+
+/* Bounding box of everything the gauge can draw */
+static void compute_damage(Gauge *g, int screen_w, int screen_h) {
+  SDL_Rect screen = {0, 0, screen_w, screen_h};
+  const SDL_Rect *v = &g->view;
+
+  if (g->type == GAUGE_NEEDLE) {
+    // Square around the pivot covering the full sweep
+    int cx = v->x + g->view_pivot.x;
+    int cy = v->y + g->view_pivot.y;
+    int dx = (g->view_pivot.x > v->w - g->view_pivot.x) ? g->view_pivot.x : v->w - g->view_pivot.x;
+    int dy = (g->view_pivot.y > v->h - g->view_pivot.y) ? g->view_pivot.y : v->h - g->view_pivot.y;
+    int radius = (int)ceil(sqrt((double)dx * dx + (double)dy * dy)) + 1;
+    SDL_Rect sweep = {cx - radius, cy - radius, radius * 2, radius * 2};
+    SDL_IntersectRect(&sweep, &screen, &g->damage);
+  } else {
+    SDL_IntersectRect(v, &screen, &g->damage);
+  }
+}
+
+/* Static decoration drawn once into the layer, relative to the damage area */
+static void draw_decoration(SDL_Renderer *r, const Gauge *g) {
+  SDL_Rect track = {g->view.x - g->damage.x, g->view.y - g->damage.y, g->view.w, g->view.h};
+
+  if (g->type == GAUGE_BAR) {
+    SDL_SetRenderDrawColor(r, g->color.r / 5, g->color.g / 5, g->color.b / 5, 255);
+    SDL_RenderFillRect(r, &track);
+    SDL_SetRenderDrawColor(r, 96, 96, 96, 255);
+    SDL_RenderDrawRect(r, &track);
+  } else if (g->type == GAUGE_TELLTALE && !g->tex) {
+    SDL_SetRenderDrawColor(r, g->color.r / 4, g->color.g / 4, g->color.b / 4, 255);
+    SDL_RenderDrawRect(r, &track);
+  }
+}
+
+static void draw_dynamic(SDL_Renderer *r, const Gauge *g) {
+  switch (g->type) {
+  case GAUGE_NEEDLE: {
+    double angle = g->shown * g->max_angle / g->steps;
+    SDL_RenderCopyEx(r, g->on_img, NULL, &g->view, angle, &g->view_pivot, SDL_FLIP_NONE);
+    break;
+  }
+  case GAUGE_BAR: {
+    SDL_Rect fill = g->view;
+    fill.w = g->view.w * g->shown / g->steps;
+    if (fill.w == 0) break;
+    SDL_SetRenderDrawColor(r, g->color.r, g->color.g, g->color.b, 255);
+    SDL_RenderFillRect(r, &fill);
+    break;
+  }
+  case GAUGE_TELLTALE: {
+    SDL_Texture *img = g->shown ? g->on_img : g->off_img;
+    if (img) {
+      SDL_RenderCopy(r, img, NULL, &g->view);
+    } else if (g->shown) {
+      SDL_SetRenderDrawColor(r, g->color.r, g->color.g, g->color.b, 255);
+      SDL_RenderFillRect(r, &g->view);
+    }
+    break;
+  }
+  }
+}
+
+/* Lays the gauges out over a background of the output size and builds their
+ * damage regions, static layers and resampled textures. Returns 0 on success */
+int gauge_init(SDL_Renderer *r, SDL_Texture *background, Gauge *gauges, int n) {
+  int screen_w = 0, screen_h = 0;
+  SDL_Texture *target = SDL_GetRenderTarget(r);
+
+  if (SDL_QueryTexture(background, NULL, NULL, &screen_w, &screen_h) != 0) {
+    fprintf(stderr, "SDL_QueryTexture failed: %s\n", SDL_GetError());
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    Gauge *g = &gauges[i];
+
+    if (g->type == GAUGE_TELLTALE) g->steps = 1;
+    g->view = pixel_rect(&g->dst, screen_w, screen_h);
+    g->view_pivot.x = (int)lround(g->pivot.x * g->view.w);
+    g->view_pivot.y = (int)lround(g->pivot.y * g->view.h);
+    compute_damage(g, screen_w, screen_h);
+
+    if (g->tex) g->on_img = gauge_image(r, g, *g->tex);
+    if (g->off_tex) g->off_img = gauge_image(r, g, *g->off_tex);
+    if ((g->tex && !g->on_img) || (g->off_tex && !g->off_img)) return -1;
+
+    g->layer = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                 g->damage.w, g->damage.h);
+    if (!g->layer) {
+      fprintf(stderr, "Could not create gauge layer: %s\n", SDL_GetError());
+      return -1;
+    }
+    SDL_SetRenderTarget(r, g->layer);
+    SDL_RenderCopy(r, background, &g->damage, NULL);
+    draw_decoration(r, g);
+    g->shown = -1;
+    g->dirty = 1;
+  }
+
+  SDL_SetRenderTarget(r, target);
+  return 0;
+}
+
+void gauge_free(Gauge *gauges, int n) {
+  for (int i = 0; i < n; i++) {
+    Gauge *g = &gauges[i];
+    if (g->layer) SDL_DestroyTexture(g->layer);
+    if (g->on_img) SDL_DestroyTexture(g->on_img);
+    if (g->off_img) SDL_DestroyTexture(g->off_img);
+    g->layer = g->on_img = g->off_img = NULL;
+  }
+}
+
+/* Forces every gauge to be redrawn on the next gauge_render() */
+void gauge_invalidate(Gauge *gauges, int n) {
+  for (int i = 0; i < n; i++) gauges[i].dirty = 1;
+}
+
+/* Picks up new positions from the car state, returns how many gauges need drawing */
+int gauge_update(Gauge *gauges, int n, const CarState *state) {
+  int dirty = 0;
+  for (int i = 0; i < n; i++) {
+    Gauge *g = &gauges[i];
+    int pos = quantize(g, source_value(state, g->source));
+    if (pos != g->shown) {
+      g->shown = pos;
+      g->dirty = 1;
+    }
+    dirty += g->dirty;
+  }
+  return dirty;
+}
+
+/* Redraws the damage region of every dirty gauge */
+void gauge_render(SDL_Renderer *r, Gauge *gauges, int n) {
+  for (int i = 0; i < n; i++) {
+    const Gauge *g = &gauges[i];
+    if (!g->dirty) continue;
+
+    SDL_RenderSetClipRect(r, &g->damage);
+    // Static layers first so overlapping dynamic parts are not painted over
+    for (int j = 0; j < n; j++) {
+      if (j == i || SDL_HasIntersection(&gauges[j].damage, &g->damage))
+        SDL_RenderCopy(r, gauges[j].layer, NULL, &gauges[j].damage);
+    }
+    for (int j = 0; j < n; j++) {
+      if (j == i || SDL_HasIntersection(&gauges[j].damage, &g->damage))
+        draw_dynamic(r, &gauges[j]);
+    }
+  }
+  SDL_RenderSetClipRect(r, NULL);
+  for (int i = 0; i < n; i++) gauges[i].dirty = 0;
+}
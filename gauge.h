@@ -0,0 +1,71 @@
+#ifndef GAUGE_H
+#define GAUGE_H
+
+#include <SDL2/SDL.h>
+
+#include "icsim.h"
+
+/* === Constants === */
+
+// Widget types
+#define GAUGE_NEEDLE 0   // Rotating needle texture
+#define GAUGE_BAR 1      // Horizontal bar filled from the left
+#define GAUGE_TELLTALE 2 // On/off sprite or lamp
+
+// Car state values a gauge can show
+#define GAUGE_SRC_SPEED 0
+#define GAUGE_SRC_RPM 1
+#define GAUGE_SRC_TURN_LEFT 2
+#define GAUGE_SRC_TURN_RIGHT 3
+#define GAUGE_SRC_DOOR_FL 4 // 1 when the door is unlocked
+#define GAUGE_SRC_DOOR_FR 5
+#define GAUGE_SRC_DOOR_RL 6
+#define GAUGE_SRC_DOOR_RR 7
+#define GAUGE_SRC_ANY_DOOR 8 // 1 when any door is unlocked
+#define GAUGE_SRC_HANDBRAKE 9
+#define GAUGE_SRC_LOCKED 10 // 1 while UDS security is locked
+#define GAUGE_SRC_BUS_LOAD 11 // Percent
+
+/* === Structures === */
+
+// Rectangle in fractions of what it lies on: the cluster for dst, the texture for src
+typedef struct {
+  double x, y, w, h;
+} GaugeRect;
+
+// A gauge is declared as data: the first block of fields describes it
+// independently of any resolution, and the runtime block is filled in by
+// gauge_init() for the size the cluster is drawn at.
+typedef struct {
+  int type;                      // GAUGE_*
+  int source;                    // GAUGE_SRC_*
+  double min, max;               // Value range mapped onto the gauge
+  int steps;                     // Distinct positions (needle degrees, bar segments)
+  GaugeRect dst;                 // Dynamic part
+  SDL_Texture **tex;             // Needle, or telltale sprite when on
+  SDL_Texture **off_tex;         // Telltale sprite when off, may be NULL
+  GaugeRect src;                 // Sprite area, w == 0 for the whole texture
+  struct { double x, y; } pivot; // Needle rotation center in fractions of dst
+  double max_angle;              // Needle sweep in degrees
+  SDL_Color color;               // Bar fill, or telltale lamp when there is no sprite
+
+  // Runtime, in output pixels
+  SDL_Rect view;        // dst at the output scale
+  SDL_Point view_pivot; // pivot at the output scale
+  SDL_Texture *on_img;  // Needle or sprites resampled to exactly view size
+  SDL_Texture *off_img;
+  SDL_Rect damage;    // Screen area owned by the gauge
+  SDL_Texture *layer; // Cached static layer (background + decoration)
+  int shown;          // Position currently on screen, -1 before first draw
+  int dirty;
+} Gauge;
+
+/* === Prototypes === */
+
+int gauge_init(SDL_Renderer *r, SDL_Texture *background, Gauge *gauges, int n);
+void gauge_free(Gauge *gauges, int n);
+void gauge_invalidate(Gauge *gauges, int n);
+int gauge_update(Gauge *gauges, int n, const CarState *state);
+void gauge_render(SDL_Renderer *r, Gauge *gauges, int n);
+
+#endif // GAUGE_H
@@ -0,0 +1,243 @@
+/*
+ * Per ID byte change heatmap, a cansniffer style view for finding signals
+ *
+ * Every frame is XORed against the previous payload of its ID: bytes that
+ * differ bump a saturating per byte counter and the differing bits are ORed
+ * into a per window bit mask.  With SSE2 that is one XOR, compare, saturating
+ * add and OR per 16 bytes of payload, and finding the row is a table lookup,
+ * so the cost per frame does not depend on how many IDs are on the bus.
+ *
+ * Once per window the rows are copied out under the state lock, the counters
+ * halved and the bit masks cleared, so the heat fades when a byte goes quiet.
+ * Sorting the copy by ID is left until after the lock is released.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "heatmap.h"
+
+// 3x5 hex digits, one bit per dot, top row first
+static const uint16_t font[16] = {
+    0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249,
+    0x7BEF, 0x7BCF, 0x7BED, 0x6BAE, 0x7927, 0x6B6E, 0x79E7, 0x79E4,
+};
+
+int heatmap_init(HeatMap *h) {
+  memset(h, 0, sizeof(*h));
+  h->rows = aligned_alloc(16, HEATMAP_MAX_IDS * sizeof(HeatRow));
+  if (!h->rows) return -1;
+  memset(h->rows, 0, HEATMAP_MAX_IDS * sizeof(HeatRow));
+  return 0;
+}
+
+void heatmap_free(HeatMap *h) {
+  free(h->rows);
+  h->rows = NULL;
+}
+
+/* Row of an ID, creating it on first sight. NULL when the tables are full */
+static HeatRow *find_row(HeatMap *h, canid_t id, int *is_new) {
+  uint16_t *slot;
+
+  *is_new = 0;
+  if (id & CAN_EFF_FLAG) {
+    uint32_t hash = ((id & CAN_EFF_MASK) * 2654435761U) >> 22; // 10 bits, HEATMAP_EXT_SLOTS
+    slot = NULL;
+    for (int i = 0; i < HEATMAP_EXT_PROBE; i++) {
+      int s = (hash + i) & (HEATMAP_EXT_SLOTS - 1);
+      if (!h->ext_row[s] || h->ext_id[s] == id) {
+        slot = &h->ext_row[s];
+        h->ext_id[s] = id;
+        break;
+      }
+    }
+    if (!slot) return NULL;
+  } else {
+    slot = &h->std_row[id & CAN_SFF_MASK];
+  }
+
+  if (*slot) return &h->rows[*slot - 1];
+  if (h->nrows == HEATMAP_MAX_IDS) return NULL;
+  *slot = ++h->nrows;
+  *is_new = 1;
+  h->rows[*slot - 1].id = id;
+  return &h->rows[*slot - 1];
+}
+
+void heatmap_add(HeatMap *h, const struct canfd_frame *cf) {
+  uint8_t in[CANFD_MAX_DLEN] __attribute__((aligned(16)));
+  int len = (cf->len > CANFD_MAX_DLEN) ? CANFD_MAX_DLEN : cf->len;
+  int is_new;
+  HeatRow *row = find_row(h, cf->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK), &is_new);
+
+  if (!row) {
+    h->dropped++;
+    return;
+  }
+
+  // Bytes past len are left over from earlier frames in the socket buffer
+  int span = (len + 15) & ~15;
+  memset(in + len, 0, span - len);
+  memcpy(in, cf->data, len);
+  if (len > row->len) row->len = len;
+  if (is_new) {
+    memcpy(row->data, in, span);
+    return;
+  }
+
+#ifdef __SSE2__
+  const __m128i one = _mm_set1_epi8(1);
+  for (int i = 0; i < span; i += 16) {
+    __m128i now = _mm_load_si128((const __m128i *)(in + i));
+    __m128i diff = _mm_xor_si128(now, _mm_load_si128((const __m128i *)(row->data + i)));
+    __m128i same = _mm_cmpeq_epi8(diff, _mm_setzero_si128());
+    __m128i count = _mm_load_si128((const __m128i *)(row->changes + i));
+    __m128i bits = _mm_load_si128((const __m128i *)(row->bits + i));
+    _mm_store_si128((__m128i *)(row->changes + i), _mm_adds_epu8(count, _mm_andnot_si128(same, one)));
+    _mm_store_si128((__m128i *)(row->bits + i), _mm_or_si128(bits, diff));
+    _mm_store_si128((__m128i *)(row->data + i), now);
+  }
+#else
+  for (int i = 0; i < span; i++) {
+    uint8_t diff = in[i] ^ row->data[i];
+    if (diff && row->changes[i] < 255) row->changes[i]++;
+    row->bits[i] |= diff;
+    row->data[i] = in[i];
+  }
+#endif
+}
+
+static int compare_rows(const void *a, const void *b) {
+  canid_t ia = ((const HeatRow *)a)->id;
+  canid_t ib = ((const HeatRow *)b)->id;
+  return (ia > ib) - (ia < ib);
+}
+
+int heatmap_window(HeatMap *h, HeatRow *out) {
+  int n = h->nrows;
+
+  memcpy(out, h->rows, n * sizeof(HeatRow));
+  for (int r = 0; r < n; r++) {
+    HeatRow *row = &h->rows[r];
+#ifdef __SSE2__
+    const __m128i low7 = _mm_set1_epi8(0x7f);
+    for (int i = 0; i < CANFD_MAX_DLEN; i += 16) {
+      __m128i count = _mm_load_si128((const __m128i *)(row->changes + i));
+      _mm_store_si128((__m128i *)(row->changes + i), _mm_and_si128(_mm_srli_epi16(count, 1), low7));
+    }
+#else
+    for (int i = 0; i < CANFD_MAX_DLEN; i++) row->changes[i] >>= 1;
+#endif
+    memset(row->bits, 0, sizeof(row->bits));
+  }
+  return n;
+}
+
+void heatmap_sort(HeatRow *rows, int n) {
+  qsort(rows, n, sizeof(HeatRow), compare_rows);
+}
+
+static char heat_char(uint8_t count) {
+  if (count == 0) return '.';
+  if (count == 1) return '-';
+  if (count < 4) return '+';
+  if (count < 16) return '*';
+  return '#';
+}
+
+/* Text view, only IDs that changed during the window */
+void heatmap_print(const HeatRow *rows, int n) {
+  int quiet = 0;
+
+  for (int r = 0; r < n; r++) {
+    const HeatRow *row = &rows[r];
+    int changed = 0;
+    char id[12];
+
+    for (int i = 0; i < row->len; i++) changed |= row->bits[i];
+    if (!changed) {
+      quiet++;
+      continue;
+    }
+    if (row->id & CAN_EFF_FLAG) {
+      snprintf(id, sizeof(id), "%08X", row->id & CAN_EFF_MASK);
+    } else {
+      snprintf(id, sizeof(id), "%03X", row->id);
+    }
+    for (int start = 0; start < row->len; start += HEATMAP_BYTES_PER_LINE) {
+      int end = start + HEATMAP_BYTES_PER_LINE;
+      char heat[HEATMAP_BYTES_PER_LINE + 1];
+
+      if (end > row->len) end = row->len;
+      printf("[HEATMAP] %-8s", start ? "" : id);
+      for (int i = start; i < end; i++) printf(" %02X", row->data[i]);
+      printf("%*s", (HEATMAP_BYTES_PER_LINE - (end - start)) * 3 + 2, "");
+      for (int i = start; i < end; i++) heat[i - start] = heat_char(row->changes[i]);
+      heat[end - start] = '\0';
+      printf("%-*s  bits", HEATMAP_BYTES_PER_LINE, heat);
+      for (int i = start; i < end; i++) printf(" %02X", row->bits[i]);
+      printf("\n");
+    }
+  }
+  printf("[HEATMAP] %d IDs changed, %d unchanged\n", n - quiet, quiet);
+}
+
+static void draw_digit(SDL_Renderer *r, int x, int y, int digit) {
+  for (int dot = 0; dot < 15; dot++) {
+    if (!(font[digit] & (0x4000 >> dot))) continue;
+    SDL_Rect px = {x + (dot % 3) * 2, y + (dot / 3) * 2, 2, 2};
+    SDL_RenderFillRect(r, &px);
+  }
+}
+
+/* Black through red to yellow as a byte changes more often */
+static void set_heat_color(SDL_Renderer *r, uint8_t count) {
+  int v = (count >= 16) ? 255 : count * 16;
+  if (count == 0) {
+    SDL_SetRenderDrawColor(r, 40, 40, 40, 255);
+  } else {
+    SDL_SetRenderDrawColor(r, 96 + v * 159 / 255, v * v / 255, 0, 255);
+  }
+}
+
+/* One line per 8 bytes: the ID, then a heat cell per byte with its changed bits below */
+void heatmap_render(SDL_Renderer *r, const HeatRow *rows, int n) {
+  int y = 2;
+
+  SDL_SetRenderDrawColor(r, 0, 0, 0, 255);
+  SDL_RenderClear(r);
+  for (int ri = 0; ri < n && y + HEATMAP_ROW_HEIGHT <= HEATMAP_HEIGHT; ri++) {
+    const HeatRow *row = &rows[ri];
+    int digits = (row->id & CAN_EFF_FLAG) ? 8 : 3;
+
+    SDL_SetRenderDrawColor(r, 200, 200, 200, 255);
+    for (int d = 0; d < digits; d++) {
+      int digit = ((row->id & CAN_EFF_MASK) >> ((digits - 1 - d) * 4)) & 0xf;
+      draw_digit(r, HEATMAP_ID_X + d * 8, y, digit);
+    }
+
+    for (int i = 0; i < row->len; i++) {
+      int x = HEATMAP_CELLS_X + (i % HEATMAP_BYTES_PER_LINE) * HEATMAP_CELL_W;
+      if (i && i % HEATMAP_BYTES_PER_LINE == 0) y += HEATMAP_ROW_HEIGHT;
+      if (y + HEATMAP_ROW_HEIGHT > HEATMAP_HEIGHT) break;
+
+      SDL_Rect cell = {x, y, HEATMAP_CELL_W - 2, 6};
+      set_heat_color(r, row->changes[i]);
+      SDL_RenderFillRect(r, &cell);
+
+      SDL_SetRenderDrawColor(r, 255, 255, 255, 255);
+      for (int b = 0; b < 8; b++) {
+        if (!(row->bits[i] & (0x80 >> b))) continue;
+        SDL_Rect bit = {x + 1 + b * 2, y + 7, 1, 3};
+        SDL_RenderFillRect(r, &bit);
+      }
+    }
+    y += HEATMAP_ROW_HEIGHT;
+  }
+  SDL_RenderPresent(r);
+}
@@ -0,0 +1,62 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <SDL2/SDL.h>
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+// Output modes (icsim -H)
+#define HEATMAP_OFF 0
+#define HEATMAP_WINDOW 1
+#define HEATMAP_TEXT 2
+
+#define HEATMAP_MAX_IDS 512     // Rows, IDs seen after that are counted but not shown
+#define HEATMAP_EXT_SLOTS 1024  // Open addressed index for extended IDs
+#define HEATMAP_EXT_PROBE 16
+#define HEATMAP_WINDOW_MS 1000  // Counters are halved every window
+#define HEATMAP_BYTES_PER_LINE 8
+
+// Window layout: up to 8 ID digits of 8 pixels, then the byte cells
+#define HEATMAP_ROW_HEIGHT 12
+#define HEATMAP_CELL_W 20
+#define HEATMAP_ID_X 4
+#define HEATMAP_CELLS_X (HEATMAP_ID_X + 8 * 8 + 4)
+#define HEATMAP_WIDTH (HEATMAP_CELLS_X + HEATMAP_BYTES_PER_LINE * HEATMAP_CELL_W)
+#define HEATMAP_HEIGHT 600
+
+/* === Structures === */
+
+// One ID, the vectors are 16 byte aligned for the SSE2 update
+typedef struct {
+  uint8_t data[CANFD_MAX_DLEN] __attribute__((aligned(16)));    // Last payload
+  uint8_t changes[CANFD_MAX_DLEN] __attribute__((aligned(16))); // Saturating change count per byte
+  uint8_t bits[CANFD_MAX_DLEN] __attribute__((aligned(16)));    // Bits that changed this window
+  canid_t id;                                                   // CAN_EFF_FLAG set for extended IDs
+  uint8_t len;                                                  // Longest payload seen
+} HeatRow;
+
+// Written by the RX thread, copied out with heatmap_window() under the state lock
+typedef struct {
+  HeatRow *rows;                        // HEATMAP_MAX_IDS, in the order IDs were first seen
+  int nrows;
+  uint64_t dropped;                     // Frames of IDs without a row
+  uint16_t std_row[2048];               // Row + 1 per standard ID, 0 = none
+  canid_t ext_id[HEATMAP_EXT_SLOTS];
+  uint16_t ext_row[HEATMAP_EXT_SLOTS];  // Row + 1, 0 = free slot
+} HeatMap;
+
+/* === Prototypes === */
+
+int heatmap_init(HeatMap *h);
+void heatmap_free(HeatMap *h);
+void heatmap_add(HeatMap *h, const struct canfd_frame *cf);
+// Copies the rows into out (HEATMAP_MAX_IDS), then decays the counters
+int heatmap_window(HeatMap *h, HeatRow *out);
+// Orders a copy by ID, call it without holding the state lock
+void heatmap_sort(HeatRow *rows, int n);
+void heatmap_print(const HeatRow *rows, int n);
+void heatmap_render(SDL_Renderer *r, const HeatRow *rows, int n);
+
+#endif // HEATMAP_H
@@ -0,0 +1,453 @@
+/*
+ * Offline replay of candump logs through the cluster decoders
+ *
+ * Feeds every frame of a log straight into decode_frame() (no socket, no
+ * window) on a virtual clock driven by the log timestamps, and writes one
+ * trace line per CarState transition.  With -g the trace is compared against
+ * a golden file instead, so decoder changes can be regression tested in bulk.
+ *
+ *   icreplay -m bmw -o golden.trace capture.log
+ *   icreplay -m bmw -g golden.trace capture.log
+ *   icreplay -m bmw -S 47:00 capture.log      # From minute 47, see logindex.h
+ *   icreplay -m bmw -p shots/ capture.log      # One picture of the cluster per trace line
+ *
+ * Pictures are drawn offscreen by the same code as the icsim window (cluster.c),
+ * with a software renderer on a surface, so no display is needed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "cluster.h"
+#include "icsim.h"
+#include "lib.h"
+#include "logindex.h"
+
+#define TRACE_LINE_LEN 160
+
+// Fields that make up a trace line, compared to detect transitions
+typedef struct {
+  long speed;
+  long rpm;
+  int door_status[4];
+  int turn_status[2];
+  int handbrake;
+  int lock_status;
+  int security_state;
+} TraceState;
+
+// Offscreen cluster pictures (-p and -P)
+typedef struct {
+  const char *dir;   // One picture per trace line, NULL when off
+  const char *final; // Picture of the state at the end of the log, NULL when off
+  Uint32 *pixels;
+  int w, h, pitch;
+  char last[PATH_MAX]; // Previous picture, linked when nothing visible changed
+  long written;
+  long linked;
+} Snapshots;
+
+typedef struct {
+  const char *data; // Golden trace, NULL when writing a trace
+  size_t size;
+  size_t pos;
+  long line;
+  long mismatches;
+  FILE *out;
+} Trace;
+
+static signed char hexval[256];
+
+static void usage(const char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "Usage: icreplay [options] <candump log>\n");
+  fprintf(stderr, "\t-m\tmodel NAME  (Ex: -m bmw)\n");
+  fprintf(stderr, "\t-c\tDBC file with the signal definitions\n");
+  fprintf(stderr, "\t-o\twrite the trace to FILE (default: stdout)\n");
+  fprintf(stderr, "\t-g\tcompare the trace against the golden FILE\n");
+  fprintf(stderr, "\t-q\tonly report the summary\n");
+  fprintf(stderr, "\t-S\tstart at [[HH:]MM:]SS into the log, using the .idx sidecar\n");
+  fprintf(stderr, "\t-I\tbuild the .idx sidecar and quit\n");
+  fprintf(stderr, "\t-p\twrite a picture of the cluster for every trace line to DIR/NNNNNN.ppm\n");
+  fprintf(stderr, "\t-P\twrite a picture of the cluster at the end of the log to FILE (.png or .ppm)\n");
+  exit(2);
+}
+
+static const char *map_file(const char *path, size_t *size) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  void *p;
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  *size = st.st_size;
+  if (st.st_size == 0) {
+    close(fd);
+    return "";
+  }
+  // Not populated: with -S only the index checkpoints and the replayed part are read
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+  return p;
+}
+
+/* Reads ahead from p on, the part of the log that is replayed */
+static void advise_sequential(const char *base, const char *p, size_t size) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  const char *from = (const char *)((uintptr_t)p & ~(page - 1));
+
+  if (!size) return;
+  madvise((void *)from, base + size - from, MADV_SEQUENTIAL);
+}
+
+static void capture(TraceState *t) {
+  t->speed = car_state.speed;
+  t->rpm = car_state.rpm;
+  memcpy(t->door_status, car_state.door_status, sizeof(t->door_status));
+  memcpy(t->turn_status, car_state.turn_status, sizeof(t->turn_status));
+  t->handbrake = car_state.handbrake;
+  t->lock_status = car_state.lock_status;
+  t->security_state = sec_ctx.state;
+}
+
+/* Sets up a software renderer on a surface, no window or video driver needed */
+static int snapshot_init(Snapshots *ss) {
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+  SDL_Renderer *r = surface ? SDL_CreateSoftwareRenderer(surface) : NULL;
+
+  if (!r || cluster_load(r, 0) < 0 || layout_ic() < 0) {
+    fprintf(stderr, "ERROR: Could not set up offscreen rendering: %s\n", SDL_GetError());
+    return -1;
+  }
+  ss->w = ic_view.w;
+  ss->h = ic_view.h;
+  ss->pitch = ss->w * sizeof(Uint32);
+  ss->pixels = malloc((size_t)ss->pitch * ss->h);
+  return ss->pixels ? 0 : -1;
+}
+
+/* Pictures the current state as trace line n.  An unchanged picture becomes a hard link
+ * to the previous one, so every line has a file but only changes cost a write */
+static int snapshot_line(Snapshots *ss, long n) {
+  char path[PATH_MAX];
+  int changed = cluster_snapshot(&car_state, ss->pixels, ss->pitch);
+
+  if (changed < 0) return -1;
+  snprintf(path, sizeof(path), "%s/%06ld.ppm", ss->dir, n);
+  unlink(path);
+  if (!changed && ss->last[0] && link(ss->last, path) == 0) {
+    ss->linked++;
+    return 0;
+  }
+  if (cluster_write_image(path, ss->pixels, ss->w, ss->h, ss->pitch) < 0) return -1;
+  memcpy(ss->last, path, sizeof(path));
+  ss->written++;
+  return 0;
+}
+
+/* Writes or checks one trace line */
+static void emit(Trace *tr, const char *ts, int ts_len, const char *tag, const TraceState *t) {
+  char line[TRACE_LINE_LEN];
+  int n;
+
+  n = snprintf(line, sizeof(line),
+               "%.*s %s speed=%ld rpm=%ld doors=%c%c%c%c turn=%c%c handbrake=%d lock=%d sec=%d\n",
+               ts_len, ts, tag, t->speed, t->rpm, t->door_status[0] ? 'U' : 'L',
+               t->door_status[1] ? 'U' : 'L', t->door_status[2] ? 'U' : 'L',
+               t->door_status[3] ? 'U' : 'L', t->turn_status[0] ? 'L' : '-',
+               t->turn_status[1] ? 'R' : '-', t->handbrake, t->lock_status, t->security_state);
+  if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+  tr->line++;
+
+  if (!tr->data) {
+    fwrite(line, 1, n, tr->out);
+    return;
+  }
+
+  const char *want = tr->data + tr->pos;
+  const char *eol = memchr(want, '\n', tr->size - tr->pos);
+  size_t want_len = eol ? (size_t)(eol - want) + 1 : tr->size - tr->pos;
+
+  if (want_len != (size_t)n || memcmp(want, line, n)) {
+    if (tr->mismatches++ == 0 && tr->out) {
+      fprintf(tr->out, "First difference at trace line %ld\n", tr->line);
+      fprintf(tr->out, "- %.*s\n", (int)(want_len && want[want_len - 1] == '\n' ? want_len - 1 : want_len), want);
+      fprintf(tr->out, "+ %.*s", n, line);
+    }
+  }
+  tr->pos += want_len;
+}
+
+/* Fast path for ID#HEX and ID##FHEX, anything else goes through lib's parser */
+static int parse_frame(const char *p, const char *end, struct canfd_frame *cf) {
+  const char *s = p;
+  canid_t id = 0;
+  int idlen, len = 0, maxlen = CAN_MAX_DLEN, mtu = CAN_MTU;
+  char buf[CL_CFSZ];
+
+  memset(cf, 0, sizeof(*cf));
+  while (s < end && hexval[(unsigned char)*s] >= 0) id = (id << 4) | hexval[(unsigned char)*s++];
+  idlen = s - p;
+  if (s == end || *s != '#' || (idlen != 3 && idlen != 8)) goto slow;
+  s++;
+  if (s < end && *s == '#') {
+    if (s + 1 >= end || hexval[(unsigned char)s[1]] < 0) goto slow;
+    cf->flags = hexval[(unsigned char)s[1]];
+    s += 2;
+    maxlen = CANFD_MAX_DLEN;
+    mtu = CANFD_MTU;
+  }
+  while (s + 1 < end && len < maxlen) {
+    int hi = hexval[(unsigned char)s[0]], lo = hexval[(unsigned char)s[1]];
+    if (hi < 0 || lo < 0) break;
+    cf->data[len++] = (hi << 4) | lo;
+    s += 2;
+  }
+  if (s != end && *s != '.') goto slow;
+  cf->can_id = (idlen == 8) ? (id | CAN_EFF_FLAG) : id;
+  cf->len = len;
+  return mtu;
+
+slow:
+  if (end - p >= (long)sizeof(buf)) return 0;
+  memcpy(buf, p, end - p);
+  buf[end - p] = '\0';
+  return parse_canframe(buf, cf);
+}
+
+int main(int argc, char *argv[]) {
+  const char *golden_file = NULL, *out_file = NULL, *dbc_file = NULL;
+  const char *log, *p, *end;
+  size_t log_size;
+  int opt, quiet = 0, index_only = 0;
+  uint64_t start_offset = 0;
+  LogIndex idx;
+  long frames = 0, bad = 0, first_sec = -1;
+  DbcDatabase dbc;
+  Trace tr;
+  Snapshots ss;
+  TraceState prev, cur;
+  struct timespec t0, t1;
+
+  memset(&ss, 0, sizeof(ss));
+  while ((opt = getopt(argc, argv, "m:c:o:g:qS:Ip:P:h?")) != -1) {
+    switch (opt) {
+    case 'm':
+      model = optarg;
+      break;
+    case 'c':
+      dbc_file = optarg;
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case 'g':
+      golden_file = optarg;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'S':
+      if (logindex_parse_offset(optarg, &start_offset) < 0) usage("Start time must be [[HH:]MM:]SS");
+      break;
+    case 'I':
+      index_only = 1;
+      break;
+    case 'p':
+      ss.dir = optarg;
+      break;
+    case 'P':
+      ss.final = optarg;
+      break;
+    default:
+      usage(NULL);
+    }
+  }
+  if (optind >= argc) usage("You must specify a candump log");
+  if (golden_file && out_file) usage("-o and -g can not be combined");
+
+  if (dbc_file) {
+    if (dbc_load(dbc_file, &dbc) < 0) {
+      fprintf(stderr, "ERROR: Could not load DBC file %s\n", dbc_file);
+      return 2;
+    }
+    bind_dbc_signals(&dbc);
+    active_dbc = &dbc;
+  }
+
+  memset(&tr, 0, sizeof(tr));
+  if (golden_file) {
+    tr.data = map_file(golden_file, &tr.size);
+    if (!tr.data) return 2;
+    tr.out = quiet ? NULL : stdout;
+  } else if (out_file) {
+    tr.out = fopen(out_file, "w");
+    if (!tr.out) {
+      perror(out_file);
+      return 2;
+    }
+  } else {
+    // The decoders log to stdout, keep that out of the trace
+    tr.out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+
+  log = map_file(argv[optind], &log_size);
+  if (!log) return 2;
+
+  p = log;
+  if (start_offset || index_only) {
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (logindex_open(argv[optind], log, log_size, 0, &idx) < 0) return 2;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (index_only) {
+      fprintf(stderr, "%zu checkpoints in %.3f ms\n", idx.count,
+              ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e3);
+      return 0;
+    }
+    p = log + logindex_seek(&idx, log, log_size, idx.first_ts_us + start_offset);
+    logindex_free(&idx);
+  }
+  advise_sequential(log, p, log_size);
+
+  memset(hexval, -1, sizeof(hexval));
+  for (int i = 0; i < 10; i++) hexval['0' + i] = i;
+  for (int i = 0; i < 6; i++) hexval['a' + i] = hexval['A' + i] = 10 + i;
+
+  if (ss.dir && mkdir(ss.dir, 0755) < 0 && errno != EEXIST) {
+    perror(ss.dir);
+    return 2;
+  }
+  if ((ss.dir || ss.final) && snapshot_init(&ss) < 0) return 2;
+
+  clock_init(CLOCK_VIRTUAL);
+  init_car_state();
+  capture(&prev);
+  // Picture 000000 is the state before the first frame
+  if (ss.dir && snapshot_line(&ss, 0) < 0) return 2;
+
+  const char *first = p;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (end = log + log_size; p < end; p++) {
+    const char *eol = memchr(p, '\n', end - p);
+    const char *ts, *q, *tok, *h;
+    struct canfd_frame cf;
+    long sec = 0, usec = 0;
+    int ts_len, mtu;
+    char tag[12];
+
+    if (!eol) eol = end;
+
+    // (seconds.micros) interface frame
+    if (*p != '(') goto next;
+    ts = p;
+    q = memchr(p, ')', eol - p);
+    if (!q) goto next;
+    ts_len = ++q - ts;
+    while (q < eol && *q == ' ') q++;
+    q = memchr(q, ' ', eol - q);
+    if (!q) goto next;
+    while (q < eol && *q == ' ') q++;
+    tok = q;
+    q = memchr(tok, ' ', eol - tok);
+    if (!q) q = (eol > tok && eol[-1] == '\r') ? eol - 1 : eol;
+
+    // Most of a capture is traffic the decoders ignore, only look at its ID
+    if (car_state.lock_status != OFF) {
+      canid_t id = 0;
+      h = tok;
+      while (h < q && hexval[(unsigned char)*h] >= 0) id = (id << 4) | hexval[(unsigned char)*h++];
+      if (h < q && *h == '#' && (h - tok == 3 || h - tok == 8)) {
+        if (h - tok == 8) id |= CAN_EFF_FLAG;
+        if (!decode_wants(id)) {
+          frames++;
+          goto next;
+        }
+      }
+    }
+
+    mtu = parse_frame(tok, q, &cf);
+    if (!mtu) {
+      bad++;
+      goto next;
+    }
+    frames++;
+
+    for (h = ts + 1; *h >= '0' && *h <= '9'; h++) sec = sec * 10 + (*h - '0');
+    if (*h == '.') h++;
+    for (; *h >= '0' && *h <= '9'; h++) usec = usec * 10 + (*h - '0');
+    if (first_sec < 0) first_sec = sec;
+    clock_advance_to((sec - first_sec) * 1000 + usec / 1000);
+
+    if (check_auto_lock(clock_ms())) {
+      capture(&cur);
+      emit(&tr, ts, ts_len, "auto-lock", &cur);
+      prev = cur;
+      if (ss.dir && snapshot_line(&ss, tr.line) < 0) return 2;
+    }
+
+    decode_frame(&cf, (mtu == CANFD_MTU) ? CANFD_MAX_DLEN : CAN_MAX_DLEN, -1);
+    capture(&cur);
+    if (memcmp(&cur, &prev, sizeof(cur))) {
+      if (cf.can_id & CAN_EFF_FLAG) {
+        snprintf(tag, sizeof(tag), "%08X", cf.can_id & CAN_EFF_MASK);
+      } else {
+        snprintf(tag, sizeof(tag), "%03X", cf.can_id & CAN_SFF_MASK);
+      }
+      emit(&tr, ts, ts_len, tag, &cur);
+      prev = cur;
+      if (ss.dir && snapshot_line(&ss, tr.line) < 0) return 2;
+    }
+  next:
+    p = eol;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%ld frames (%ld unparsed), %ld transitions in %.3f ms, %.0f MB/s\n", frames, bad,
+          tr.line, secs * 1e3, secs > 0 ? (end - first) / secs / 1e6 : 0);
+  if (ss.dir)
+    fprintf(stderr, "%ld pictures in %s, %ld of them unchanged and linked, %.0f/s\n", ss.written + ss.linked,
+            ss.dir, ss.linked, secs > 0 ? (ss.written + ss.linked) / secs : 0);
+  if (ss.final) {
+    if (cluster_snapshot(&car_state, ss.pixels, ss.pitch) < 0 ||
+        cluster_write_image(ss.final, ss.pixels, ss.w, ss.h, ss.pitch) < 0)
+      return 2;
+  }
+
+  if (golden_file) {
+    long extra = 0;
+    // Golden lines the replay never produced
+    for (size_t i = tr.pos; i < tr.size; i++)
+      if (tr.data[i] == '\n') extra++;
+    if (tr.pos < tr.size && tr.data[tr.size - 1] != '\n') extra++;
+    if (tr.mismatches || extra) {
+      printf("FAIL: %ld of %ld lines differ, %ld golden lines missing\n", tr.mismatches, tr.line,
+             extra);
+      return 1;
+    }
+    if (!quiet) printf("OK: %ld lines match %s\n", tr.line, golden_file);
+    return 0;
+  }
+
+  fclose(tr.out);
+  if (dbc_file) dbc_free(&dbc);
+  return 0;
+}
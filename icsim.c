@@ -5,6 +5,7 @@
  * (c) 2025 NCES - Ryo Kurachi <kurachi@nces.i.nagoya-u.ac.jp>
  */
 
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -21,9 +22,28 @@
 #include <SDL2/SDL_image.h>
 #include <locale.h>
 #include <errno.h>
+#include <signal.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include "lib.h"
 #include "icsim.h"
+#include "cluster.h"
+#include "flightrec.h"
+#include "icsim_shm.h"
+#include "clock.h"
+#include "latency.h"
+#include "busstats.h"
+#include "heatmap.h"
+#include "rxring.h"
+#include "notify.h"
+#include "canerr.h"
+#include "pcapng.h"
+#include "videorec.h"
 
 #ifndef DATA_DIR
 #define DATA_DIR "./data/"  // Needs trailing slash
@@ -31,49 +51,55 @@
 
 
 const int canfd_on = 1;
-int debug = 0;
 int randomize = 0;
 int seed = 0;
-int door_pos = DEFAULT_DOOR_BYTE;
-int signal_pos = DEFAULT_SIGNAL_BYTE;
-int speed_pos = DEFAULT_SPEED_BYTE;
-char *model = NULL;
 char data_file[256];
 int running = 1;
-canid_t door_id = DEFAULT_DOOR_ID;
-canid_t signal_id = DEFAULT_SIGNAL_ID;
-canid_t speed_id = DEFAULT_SPEED_ID;
-
-SDL_Renderer *renderer = NULL;
-SDL_Texture *base_texture = NULL;
-SDL_Texture *needle_tex = NULL;
-SDL_Texture *sprite_tex = NULL;
-SDL_Texture *lock_tex = NULL;
-SDL_Texture *unlock_tex = NULL;
-
-SDL_Rect speed_rect;
+char *dbc_file = NULL;
+struct timespec start_time;
+FlightRecorder flightrec;
+unsigned flightrec_secs = 0;
+char *flightrec_file = "icsim-flightrec.log";
+volatile sig_atomic_t flightrec_dump_requested = 0;
+char *pcap_file = NULL; // -w, pcapng capture of everything received
+PcapWriter pcap;
+char *video_file = NULL; // -v, Y4M recording of the display
+VideoRecorder video;
+SDL_Texture *video_frame = NULL; // ic_frame at the recording size, after a resize
+char *shm_name = NULL;
+IcsimShm *shm = NULL;
+int virtual_clock = 0;
+int latency_mode = 0;
+LatencyHist latency_hist;
+int latency_seen = 0;    // A tagged frame has been received
+Uint8 latency_seq;       // Sequence of the last input
+int latency_pending = 0; // Input decoded but not yet on screen
+Uint32 latency_sent_us;
+DbcDatabase dbc;
+int bus_overlay = 0;
+int busstats_on = 0;
+long bitrate = CAN_BITRATE;
+BusStats bus_stats;
+BusStats bus_window; // Copy printed by the debug report
+int heatmap_mode = HEATMAP_OFF;
+HeatMap heatmap;
+HeatRow heat_rows[HEATMAP_MAX_IDS]; // Last window, drawn outside of the lock
+SDL_Window *heat_window = NULL;
+SDL_Renderer *heat_renderer = NULL;
+
+int fullscreen = 0; // -x, F11 toggles
 SDL_Thread* can_thread = NULL;
+SDL_Thread* decode_thread = NULL;
+RxRing rx_ring;
+int rx_cpu = -1;     // -C, -1 leaves the threads unpinned
+int decode_cpu = -1;
+int rt_priority = 0; // -P, SCHED_FIFO priority of the RX and decode threads
+int lock_memory = 0; // -M
+int shutdown_fd = -1; // eventfd, written once to stop the RX thread
+char can_ifname[IFNAMSIZ];
+CanErrorStats can_errors;
 SDL_mutex* state_mutex;
 
-// Global car state
-CarState car_state;
-// Redraw flags
-RedrawFlags redraw_flags = {1, 1, 1, 1};
-
-// Security context for UDS Security Access
-SecurityContext sec_ctx = {
-  .state = SEC_STATE_LOCKED_NO_SEED,
-  .seed = 0,
-  .seed_sent_time = 0,
-  .timeout_ms = 10000  // 10 seconds
-};
-
-// Simple map function
-long map(long x, long in_min, long in_max, long out_min, long out_max)
-{
-  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-}
-
 // Adds data dir to file name
 // Uses a single pointer so not to have a memory leak
 // returns point to data_files or NULL if append is too large
@@ -84,207 +110,71 @@ char *get_data(char *fname) {
   return data_file;
 }
 
-/* Default vehicle state */
-void init_car_state() {
-  car_state.speed = 0;
-  car_state.door_status[0] = DOOR_LOCKED;
-  car_state.door_status[1] = DOOR_LOCKED;
-  car_state.door_status[2] = DOOR_LOCKED;
-  car_state.door_status[3] = DOOR_LOCKED;
-  car_state.turn_status[0] = OFF;
-  car_state.turn_status[1] = OFF;
-  car_state.lock_status = ON;
-}
-
-/* Empty IC */
-void blank_ic() {
-  SDL_RenderCopy(renderer, base_texture, NULL, NULL);
-}
-
-/* Updates speedo */
-void update_speed(CarState* state) {
-  SDL_Point center;
-  double angle = 0;
-  center.x = 135;
-  center.y = 20;
-  angle = map(state->speed, 0, 280, 0, 180);
-  if(angle < 0) angle = 0;
-  if(angle > 180) angle = 180;
-  SDL_RenderCopyEx(renderer, needle_tex, NULL, &speed_rect, angle, &center, SDL_FLIP_NONE);
-}
-
-/* Updates door unlocks simulated by door open icons */
-void update_doors(CarState* state) {
-  SDL_Rect update, pos;
-  // If any door is unlocked, draw the red body and the specific open doors
-  const SDL_Point sprite_coords[4] = {
-    {420, 263}, // Front Left
-    {484, 261}, // Front Right
-    {420, 284}, // Rear Left
-    {484, 287}  // Rear Right
-  };
-  const SDL_Point offset = {22, 22};
-  const SDL_Point body_sprite = {440, 239};
-  const SDL_Point body_size   = {45, 83};
-  const SDL_Point door_size   = {21, 22};
-
-  // Red body is drawn if any door is unlocked
-  for (int i = 0; i < 4; ++i) {
-    if (state->door_status[i] == DOOR_UNLOCKED) {
-      SDL_Rect src = {body_sprite.x, body_sprite.y, body_size.x, body_size.y};
-      SDL_Rect dst = {src.x - offset.x, src.y - offset.y, src.w, src.h};
-      SDL_RenderCopy(renderer, sprite_tex, &src, &dst);
-      break;
-    }
-  }
-
-  // Draw each door that is unlocked
-  for (int i = 0; i < 4; ++i) {
-    if (state->door_status[i] == DOOR_UNLOCKED) {
-      SDL_Rect src = {sprite_coords[i].x, sprite_coords[i].y, door_size.x, door_size.y};
-      SDL_Rect dst = {src.x - offset.x, src.y - offset.y, src.w, src.h};
-      SDL_RenderCopy(renderer, sprite_tex, &src, &dst);
+/* Kernel receive timestamp of the last recvmsg(), or the current time */
+void frame_timestamp(struct msghdr *msg, struct timeval *tv) {
+  struct cmsghdr *cmsg;
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP) {
+      memcpy(tv, CMSG_DATA(cmsg), sizeof(*tv));
+      return;
     }
   }
+  gettimeofday(tv, NULL);
 }
 
-/* Updates turn signals */
-void update_turn_signals(CarState* state) {
-  SDL_Rect left, right, lpos, rpos;
-  left.x = 213;
-  left.y = 51;
-  left.w = 45;
-  left.h = 45;
-  memcpy(&right, &left, sizeof(SDL_Rect));
-  right.x = 482;
-  memcpy(&lpos, &left, sizeof(SDL_Rect));
-  memcpy(&rpos, &right, sizeof(SDL_Rect));
-  lpos.x -= 22;
-  lpos.y -= 22;
-  rpos.x -= 22;
-  rpos.y -= 22;
-
-  if(state->turn_status[0] == ON) {
-	SDL_RenderCopy(renderer, sprite_tex, &left, &lpos);
-  }
-  if(state->turn_status[1] == ON) {
-	SDL_RenderCopy(renderer, sprite_tex, &right, &rpos);
-  }
-}
-
-void update_lock_icon(CarState* state) {
-  SDL_Texture* tex = (state->lock_status == OFF) ? unlock_tex : lock_tex;
-  int tex_w = 0, tex_h = 0;
-  int win_w = 0, win_h = 0;
-
-  // Get the texture size
-  if (SDL_QueryTexture(tex, NULL, NULL, &tex_w, &tex_h) != 0) {
-    fprintf(stderr, "SDL_QueryTexture failed: %s\n", SDL_GetError());
-    return;
-  }
-
-  // Get the window size (output size of the render target)
-  if (SDL_GetRendererOutputSize(renderer, &win_w, &win_h) != 0) {
-    fprintf(stderr, "SDL_GetRendererOutputSize failed: %s\n", SDL_GetError());
-    return;
-  }
-
-  // Padding (displayed slightly inward from the bottom right)
-  const int padding = 10;
-
-  // Calculate the drawing position (bottom right)
-  SDL_Rect icon_rect = {
-    .x = win_w - tex_w - padding,
-    .y = win_h - tex_h - padding,
-    .w = tex_w,
-    .h = tex_h
-  };
-
-  SDL_RenderCopy(renderer, tex, NULL, &icon_rect);
-}
-
-
-/* Redraws the IC updating everything */
-void redraw_ic(CarState* snapshot, RedrawFlags* flags) {
-  SDL_Rect lock_icon_rect = { 600, 20, 32, 32 };
-
-  // 1. Clear the screen with the base background texture
-  blank_ic();
-  
-  // 2. Draw all dynamic components on top based on their current state
-  update_speed(snapshot);
-  update_doors(snapshot);
-  update_turn_signals(snapshot);
-  update_lock_icon(snapshot);
+void request_flightrec_dump(int sig) {
+  (void)sig;
+  flightrec_dump_requested = 1;
 }
 
-
-/* Parses CAN fram and updates current_speed */
-void update_speed_status(struct canfd_frame *cf, int maxdlen) {
-  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
-  if(len < speed_pos + 1) return;
-  if (model) {
-	  if (!strncmp(model, "bmw", 3)) {
-		  car_state.speed = (((cf->data[speed_pos + 1] - 208) * 256) + cf->data[speed_pos]) / 16;
-	  }
-  } else {
-	  int speed = cf->data[speed_pos] << 8;
-	  speed += cf->data[speed_pos + 1];
-	  speed = speed / 100; // speed in kilometers
-	  car_state.speed = speed * 0.6213751; // mph
+/* Hands the frame just presented to the video writer, never waits for it */
+void record_video_frame() {
+  Uint32 *pixels = videorec_buffer(&video);
+  if (!pixels) return; // The writer repeats the previous frame in this slot
+
+  // The video keeps the size it started with when the window is resized
+  if (ic_view.w != video.w || ic_view.h != video.h) {
+    if (!video_frame)
+      video_frame = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                      video.w, video.h);
+    if (!video_frame) return;
+    SDL_SetRenderTarget(renderer, video_frame);
+    SDL_RenderCopy(renderer, ic_frame, NULL, NULL);
   }
+  int err = SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels, video.w * sizeof(Uint32));
+  SDL_SetRenderTarget(renderer, ic_frame);
+  if (err == 0) videorec_submit(&video);
 }
 
-/* Parses CAN frame and updates turn signal status */
-void update_signal_status(struct canfd_frame *cf, int maxdlen) {
-  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
-  if(len < signal_pos) return;
-  if(cf->data[signal_pos] & CAN_LEFT_SIGNAL) {
-    car_state.turn_status[0] = ON;
-  } else {
-    car_state.turn_status[0] = OFF;
-  }
-  if(cf->data[signal_pos] & CAN_RIGHT_SIGNAL) {
-    car_state.turn_status[1] = ON;
-  } else {
-    car_state.turn_status[1] = OFF;
-  }
-}
+/* Pins the calling thread and makes it SCHED_FIFO if asked to, failures only warn */
+void tune_thread(const char *name, int cpu, int priority) {
+  int err;
 
-/* Parses CAN frame and updates door status */
-void update_door_status(struct canfd_frame *cf, int maxdlen) {
-  int len = (cf->len > maxdlen) ? maxdlen : cf->len;
-  if(len < door_pos) return;
-  if(cf->data[door_pos] & CAN_DOOR1_LOCK) {
-	car_state.door_status[0] = DOOR_LOCKED;
-  } else {
-	car_state.door_status[0] = DOOR_UNLOCKED;
-  }
-  if(cf->data[door_pos] & CAN_DOOR2_LOCK) {
-	car_state.door_status[1] = DOOR_LOCKED;
-  } else {
-	car_state.door_status[1] = DOOR_UNLOCKED;
-  }
-  if(cf->data[door_pos] & CAN_DOOR3_LOCK) {
-	car_state.door_status[2] = DOOR_LOCKED;
-  } else {
-	car_state.door_status[2] = DOOR_UNLOCKED;
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) printf("WARNING: Could not pin the %s thread to CPU %d: %s\n", name, cpu, strerror(err));
   }
-  if(cf->data[door_pos] & CAN_DOOR4_LOCK) {
-	car_state.door_status[3] = DOOR_LOCKED;
-  } else {
-	car_state.door_status[3] = DOOR_UNLOCKED;
+  if (priority > 0) {
+    struct sched_param sp = {.sched_priority = priority};
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (err) printf("WARNING: Could not make the %s thread SCHED_FIFO: %s\n", name, strerror(err));
   }
 }
 
+/* Only moves frames from the socket into the ring, everything else is in decode_frames() */
 int can_receive_thread(void* arg) {
+  struct pollfd fds[2];
+  char status[64];
+  int reported_errno = 0;
   int can_fd = *(int*)arg;
   struct canfd_frame frame;
   struct sockaddr_can addr;
   struct msghdr msg;
   struct iovec iov = {.iov_base = &frame, .iov_len = sizeof(frame)};
   char ctrlmsg[CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(__u32))];
-  extern SecurityContext sec_ctx;
 
   msg.msg_name = &addr;
   msg.msg_namelen = sizeof(addr);
@@ -294,199 +184,271 @@ int can_receive_thread(void* arg) {
   msg.msg_controllen = sizeof(ctrlmsg);
   msg.msg_flags = 0;
 
+  fds[0].fd = can_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = shutdown_fd;
+  fds[1].events = POLLIN;
+
+  tune_thread("RX", rx_cpu, rt_priority);
+  // The socket is bound and frames are taken from here on
+  printf("[READY] Receiving on %s\n", can_ifname);
+  fflush(stdout);
+  snprintf(status, sizeof(status), "READY=1\nSTATUS=Receiving on %s", can_ifname);
+  notify_send(status);
+
   while (running) {
-    int nbytes = recvmsg(can_fd, &msg, 0);
-    if (nbytes <= 0) continue;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      break;
+    }
+    if (fds[1].revents) break;
+
+    // Drain what is queued before polling again
+    for (int i = 0; i < RX_BATCH; i++) {
+      msg.msg_controllen = sizeof(ctrlmsg);
+      int nbytes = recvmsg(can_fd, &msg, MSG_DONTWAIT);
+      if (nbytes < 0) {
+        // Report each new error once, e.g. ENETDOWN while the interface is down
+        if (errno != EAGAIN && errno != EINTR && errno != reported_errno) {
+          printf("WARNING: recvmsg: %s\n", strerror(errno));
+          reported_errno = errno;
+        }
+        break;
+      }
+      if (nbytes != CAN_MTU && nbytes != CANFD_MTU) continue;
+      reported_errno = 0;
 
-    SDL_LockMutex(state_mutex);
-    if (frame.can_id == DEFAULT_DOOR_ID) update_door_status(&frame, CAN_MTU);
-    if (frame.can_id == DEFAULT_SIGNAL_ID) update_signal_status(&frame, CAN_MTU);
-    if (frame.can_id == DEFAULT_SPEED_ID) update_speed_status(&frame, CAN_MTU);
-    if (frame.can_id == UDS_DIAG_ID) update_security_status(&frame, CAN_MTU, can_fd, &sec_ctx);
-    SDL_UnlockMutex(state_mutex);
+      struct timeval tv;
+      frame_timestamp(&msg, &tv);
+      rxring_push(&rx_ring, &frame, nbytes, &tv);
     }
+  }
   return 0;
 }
 
-void Usage(char *msg) {
-  if(msg) printf("%s\n", msg);
-  printf("Usage: icsim [options] <can>\n");
-  printf("\t-r\trandomize IDs\n");
-  printf("\t-s\tseed value\n");
-  printf("\t-d\tdebug mode\n");
-  printf("\t-m\tmodel NAME  (Ex: -m bmw)\n");
-  exit(1);
-}
+/* Stops the RX and decode threads without waiting for another frame */
+void stop_threads() {
+  uint64_t one = 1;
 
-
-void update_redraw_flags(CarState* prev, CarState* curr, RedrawFlags* flags) {
-  flags->speed_redraw = (prev->speed != curr->speed);
-
-  flags->doors_redraw = 0;
-  for (int i = 0; i < 4; ++i)
-    if (prev->door_status[i] != curr->door_status[i])
-      flags->doors_redraw = 1;
-
-  flags->turn_redraw = 0;
-  for (int i = 0; i < 2; ++i)
-    if (prev->turn_status[i] != curr->turn_status[i])
-      flags->turn_redraw = 1;
-
-  flags->lock_redraw = (prev->lock_status != curr->lock_status);
+  running = 0;
+  notify_send("STOPPING=1");
+  if (write(shutdown_fd, &one, sizeof(one)) != sizeof(one)) perror("eventfd");
+  rxring_wake(&rx_ring);
+  SDL_WaitThread(can_thread, NULL);
+  SDL_WaitThread(decode_thread, NULL);
 }
 
-int send_can_response(uint32_t can_id, uint8_t* data, uint8_t len, int can_fd) {
-    struct can_frame resp;
-    memset(&resp, 0, sizeof(resp));
-    resp.can_id = can_id;
-    resp.can_dlc = len;
-    memcpy(resp.data, data, len);
+/* Decode stage, consumes the receive ring */
+int decode_frames(void* arg) {
+  int can_fd = *(int*)arg;
+  FlightRecord rec;
 
-    ssize_t n = write(can_fd, &resp, sizeof(resp));
-    if (n < 0) {
-        perror("[ERROR] write failed");
-    }
-    return n;
-}
+  uint64_t first_us = 0;
 
-int send_canfd_response(uint32_t can_id, uint8_t* data, uint8_t len, int can_fd) {
-    if (len > CANFD_MAX_DLEN) {
-        fprintf(stderr, "[ERROR] CAN FD payload too large (%d bytes)\n", len);
-        return;
+  tune_thread("decode", decode_cpu, rt_priority);
+  while (running) {
+    if (!rxring_pop(&rx_ring, &rec)) {
+      // The bus went quiet, let the capture catch up on disk
+      if (pcap_file) pcapng_flush(&pcap);
+      continue;
     }
 
-    struct canfd_frame frame;
-    memset(&frame, 0, sizeof(frame));
-
-    frame.can_id = can_id;
-    frame.len = len;  // CAN FDでは .len を使用
-    memcpy(frame.data, data, len);
-
-    ssize_t n = write(can_fd, &frame, sizeof(struct canfd_frame));
-    if (n < 0) {
-        perror("[ERROR] CAN FD write failed");
+    // Under -V simulated time is the receive time of the traffic, as in icreplay
+    if (virtual_clock) {
+      uint64_t ts_us = (uint64_t)rec.ts.tv_sec * 1000000 + rec.ts.tv_usec;
+      if (!first_us) first_us = ts_us;
+      clock_advance_to((uint32_t)((ts_us - first_us) / 1000));
     }
-    return n;
-}
-
-// UDS Security Access simulation
-#define EXPECTED_KEY 0x5A
-
-void update_security_status(struct canfd_frame *cf, int maxdlen, int can_fd, SecurityContext* ctx) {
-  if (cf->len < 2) return;
-
-  Uint8 sid = cf->data[0];
-  Uint8 subfn = cf->data[1];
-  Uint32 now = SDL_GetTicks();
-
-  struct canfd_frame resp;
-  memset(&resp, 0, sizeof(resp));
-  resp.can_id = 0x7E8;
-
-  if (sid != UDS_SECURITY_REQ) return;
 
-  if (subfn == UDS_SECURITY_REQ_SEED) {
-    ctx->seed = generate_seed();
-    ctx->seed_sent_time = now;
-
-    // 状態遷移
-    if (ctx->state == SEC_STATE_LOCKED_NO_SEED)
-      ctx->state = SEC_STATE_LOCKED_WAIT_KEY;
-    else if (ctx->state == SEC_STATE_UNLOCKED_NO_SEED)
-      ctx->state = SEC_STATE_UNLOCKED_WAIT_KEY;
-
-    resp.len = 6;
-    resp.data[0] = 0x67;
-    resp.data[1] = subfn;
-    resp.data[2] = ctx->seed;
-    resp.data[3] = ctx->seed;
-    resp.data[4] = ctx->seed;
-    resp.data[5] = 0x00;
+    if (flightrec_secs) flightrec_record(&flightrec, &rec.frame, rec.mtu, &rec.ts);
+    if (pcap_file) pcapng_record(&pcap, &rec.frame, rec.mtu, &rec.ts);
+
+    if (rec.frame.can_id & CAN_ERR_FLAG) {
+      SDL_LockMutex(state_mutex);
+      int changed = canerr_add(&can_errors, &rec.frame);
+      if (shm) export_state(&car_state, &sec_ctx, &can_errors);
+      SDL_UnlockMutex(state_mutex);
+      // Errors tend to repeat, only print when the kind of error changes
+      if (debug && changed) {
+        char text[256];
+        canerr_describe(&rec.frame, text, sizeof(text));
+        printf("[CANERR] %s\n", text);
+      }
+      continue;
+    }
 
-    send_can_response(resp.can_id, resp.data, resp.len, can_fd);
-    printf("[UDS] Sent seed: 0x%02X (subfn: 0x%02X, state: %d)\n", ctx->seed, subfn, ctx->state);
+    SDL_LockMutex(state_mutex);
+    // On simulated time the auto-lock is decided between frames, not by when the display looks
+    if (virtual_clock && check_auto_lock(clock_ms()))
+      printf("[TIMEOUT] Auto-lock after 30 seconds of inactivity\n");
+    int esi_changed = (rec.mtu == CANFD_MTU && (rec.frame.flags & CANFD_ESI)) &&
+                      canerr_add_esi(&can_errors, &rec.frame);
+    if (busstats_on) busstats_add(&bus_stats, &rec.frame, rec.mtu, &rec.ts);
+    if (heatmap_mode) heatmap_add(&heatmap, &rec.frame);
+    decode_frame(&rec.frame, (rec.mtu == CANFD_MTU) ? CANFD_MAX_DLEN : CAN_MAX_DLEN, can_fd);
+    if (latency_mode && rec.frame.can_id == speed_id) track_latency_tag(&rec.frame);
+    if (shm) export_state(&car_state, &sec_ctx, &can_errors);
+    SDL_UnlockMutex(state_mutex);
+    if (debug && esi_changed)
+      printf("[CANERR] %X was sent by an error passive node (ESI)\n", rec.frame.can_id & CAN_EFF_MASK);
   }
+  return 0;
+}
 
-  else if (subfn == UDS_SECURITY_REQ_KEY) {
-    if (ctx->state != SEC_STATE_LOCKED_WAIT_KEY && ctx->state != SEC_STATE_UNLOCKED_WAIT_KEY) {
-      printf("[UDS] Key received in invalid state\n");
-      return;
-    }
-
-    if (now - ctx->seed_sent_time > ctx->timeout_ms) {
-      ctx->state = SEC_STATE_LOCKED_NO_SEED;
-      printf("[UDS] Timeout\n");
-      return;
-    }
+/* Notes the send time of a speed frame carrying a new input (-L) */
+void track_latency_tag(struct canfd_frame *cf) {
+  Uint32 used = 3U << speed_pos;
+  Uint8 seq;
+  Uint32 sent;
+
+  if (model && !strncmp(model, "bmw", 3)) used |= 1U << MODEL_BMW_X1_HANDBRAKE_BYTE;
+  if (latency_unpack(cf->data, cf->len, used, &seq, &sent) < 0) return;
+  if (latency_seen && seq == latency_seq) return; // Periodic resend of the same input
+  // The first tag may be a resend from before icsim started, only use later ones
+  latency_pending = latency_seen;
+  latency_seen = 1;
+  latency_seq = seq;
+  latency_sent_us = sent;
+}
 
-    if (cf->len < 5) return; // SID, SubFn, key[0], key[1], key[2]
+/* Records the latency of an input once the frame showing it is presented */
+void record_latency(Uint32 sent_us) {
+  latency_add(&latency_hist, latency_now_us() - sent_us);
+  if (latency_hist.count % LATENCY_REPORT_EVERY == 0) print_latency(0);
+}
 
-    Uint8 recv_key[3] = {cf->data[2], cf->data[3], cf->data[4]};
-    Uint8 expected_key[3];
-    calculate_key(ctx->seed, expected_key);
+void print_latency(int buckets) {
+  SDL_RendererInfo info;
+  char label[64] = "unknown renderer";
 
-    if (recv_key[0] == expected_key[0] &&
-        recv_key[1] == expected_key[1] &&
-        recv_key[2] == expected_key[2]) {
+  if (SDL_GetRendererInfo(renderer, &info) == 0) snprintf(label, sizeof(label), "%s renderer", info.name);
+  latency_print(&latency_hist, label, buckets);
+}
 
-      car_state.lock_status = OFF;
-      car_state.unlock_time = SDL_GetTicks();
-      ctx->seed = 0;
-      ctx->state = SEC_STATE_UNLOCKED_NO_SEED;
+/* Bus load since the previous call in percent, for the overlay */
+int sample_bus_load() {
+  static BusLoad prev;
+  static uint32_t prev_at;
+  static int sampled = 0;
+  uint32_t now = clock_ms();
+  BusLoad total, d;
+  int pct = 0;
+
+  SDL_LockMutex(state_mutex);
+  total = bus_stats.total;
+  SDL_UnlockMutex(state_mutex);
+
+  if (sampled && now != prev_at) {
+    double secs = (now - prev_at) / 1000.0;
+    d.frames = total.frames - prev.frames;
+    d.nominal_bits = total.nominal_bits - prev.nominal_bits;
+    d.data_bits = total.data_bits - prev.data_bits;
+    pct = (int)lround(busload_ratio(&d, secs, bitrate, CANFD_DATA_BITRATE) * 100);
+  }
+  prev = total;
+  prev_at = now;
+  sampled = 1;
+  return pct;
+}
 
-      resp.len = 2;
-      resp.data[0] = 0x67;
-      resp.data[1] = subfn;
-      send_can_response(resp.can_id, resp.data, resp.len, can_fd);
-      printf("[UDS] Key correct. Unlocked.\n");
+/*
+ * Publishes the state to the shared memory segment when it changed.  Called
+ * with the state mutex held after every decoded frame, so readers see each
+ * transition as soon as it happens rather than once per rendered frame.
+ */
+void export_state(CarState *state, SecurityContext *sec, CanErrorStats *err) {
+  static IcsimShmState last;
+  static int published = 0;
+  IcsimShmState st;
+
+  memset(&st, 0, sizeof(st));
+  st.speed = state->speed;
+  st.rpm = state->rpm;
+  for (int i = 0; i < 4; i++) st.door_status[i] = state->door_status[i];
+  st.turn_status[0] = state->turn_status[0];
+  st.turn_status[1] = state->turn_status[1];
+  st.handbrake = state->handbrake;
+  st.lock_status = state->lock_status;
+  st.unlock_time = state->unlock_time;
+  st.security_state = sec->state;
+  st.seed = sec->seed;
+  st.seed_sent_time = sec->seed_sent_time;
+  st.timeout_ms = sec->timeout_ms;
+  st.err_frames = err->frames;
+  st.err_bus_off = err->bus_off;
+  st.err_passive = err->error_passive;
+  st.err_lost_arbitration = err->lost_arbitration;
+  st.err_protocol = err->protocol;
+  st.err_rx_overflow = err->rx_overflow;
+  st.err_tx_overflow = err->tx_overflow;
+  st.err_fd_esi = err->fd_esi;
+
+  if (published && !memcmp(&st, &last, sizeof(st))) return;
+  icsim_shm_publish(shm, &st);
+  last = st;
+  published = 1;
+}
 
-    } else {
-      car_state.lock_status = ON;
-      ctx->seed = 0;
-      ctx->state = SEC_STATE_LOCKED_NO_SEED;
-
-      resp.len = 3;
-      resp.data[0] = 0x7F;
-      resp.data[1] = UDS_SECURITY_REQ;
-      resp.data[2] = 0x35; // NRC: invalid key
-      send_can_response(resp.can_id, resp.data, resp.len, can_fd);
-      printf("[UDS] Invalid key: %02X %02X %02X (expected: %02X %02X %02X)\n",
-             recv_key[0], recv_key[1], recv_key[2],
-             expected_key[0], expected_key[1], expected_key[2]);
-    }
+/* Time to first frame and resident memory, for tracking startup cost */
+void print_startup_stats() {
+  struct timespec now;
+  long pages = 0, rss = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) rss = 0;
+    fclose(fp);
   }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  printf("[DEBUG] First frame after %.1f ms, RSS %ld kB\n",
+         (now.tv_sec - start_time.tv_sec) * 1e3 + (now.tv_nsec - start_time.tv_nsec) / 1e6,
+         rss * (sysconf(_SC_PAGESIZE) / 1024));
 }
 
-Uint8 generate_seed() {
-  return rand() % 256;
+void Usage(char *msg) {
+  if(msg) printf("%s\n", msg);
+  printf("Usage: icsim [options] <can>\n");
+  printf("\t-r\trandomize IDs\n");
+  printf("\t-s\tseed value\n");
+  printf("\t-d\tdebug mode\n");
+  printf("\t-m\tmodel NAME  (Ex: -m bmw)\n");
+  printf("\t-c\tDBC file with the signal definitions (Ex: -c data/icsim.dbc)\n");
+  printf("\t-F\tflight recorder: keep the last SECONDS of frames, dump on SIGUSR2\n");
+  printf("\t-f\tflight recorder dump file (default: %s, *.bin for binary)\n", flightrec_file);
+  printf("\t-w\twrite every received frame to a pcapng FILE (Wireshark)\n");
+  printf("\t-v\trecord the display to a Y4M video FILE at %d fps\n", TARGET_FPS);
+  printf("\t-x\tstart fullscreen (F11 toggles), the window can also be resized\n");
+  printf("\t-V\tvirtual clock: timers follow the receive timestamps of the traffic\n");
+  printf("\t-L\tlatency benchmark: time tagged inputs from controls -L to the screen\n");
+  printf("\t-E\texport the live state to shared memory NAME (Ex: -E %s)\n", ICSIM_SHM_DEFAULT_NAME);
+  printf("\t-B\tbus load overlay (with -d the per ID statistics are printed every %d s)\n", BUSSTATS_REPORT_MS / 1000);
+  printf("\t-C\tpin the RX thread (and the decode thread) to CPU RX[,DECODE]\n");
+  printf("\t-P\tSCHED_FIFO priority for the RX and decode threads\n");
+  printf("\t-M\tlock all memory (mlockall) to avoid page faults in the RX path\n");
+  printf("\t-H\tbyte change heatmap: 'window' or 'text' (printed every %d s)\n", HEATMAP_WINDOW_MS / 1000);
+  printf("\t-b\tnominal bit rate for the bus load (default: %d)\n", CAN_BITRATE);
+  exit(1);
 }
 
-void calculate_key(Uint8 seed, Uint8* key_out) {
-    key_out[0] = seed ^ 0xAA;
-    key_out[1] = (seed + 1) ^ 0xAA;
-    key_out[2] = (seed + 2) ^ 0xAA;
-}
+
 
 
 int main(int argc, char *argv[]) {
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
   setlocale(LC_ALL, "C");
   int opt;
   int can;
   struct ifreq ifr;
   struct sockaddr_can addr;
-  struct canfd_frame frame;
-  struct iovec iov;
-  struct msghdr msg;
-  struct cmsghdr *cmsg;
-  struct stat dirstat;
-  char ctrlmsg[CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(__u32))];
   int seed = 0;
   SDL_Event event;
 
   Uint32 frame_start;
   int frame_time;
+  Uint32 bus_sampled = 0, bus_reported = 0, heat_shown = 0;
+  int bus_load = 0;
 
-  while ((opt = getopt(argc, argv, "rs:dm:h?")) != -1) {
+  while ((opt = getopt(argc, argv, "rs:dm:c:F:f:w:v:xE:VLBb:H:C:P:Mh?")) != -1) {
     switch(opt) {
 	case 'r':
 		randomize = 1;
@@ -500,6 +462,57 @@ int main(int argc, char *argv[]) {
 	case 'm':
 		model = optarg;
 		break;
+	case 'c':
+		dbc_file = optarg;
+		break;
+	case 'F':
+		flightrec_secs = atoi(optarg);
+		break;
+	case 'f':
+		flightrec_file = optarg;
+		break;
+	case 'w':
+		pcap_file = optarg;
+		break;
+	case 'v':
+		video_file = optarg;
+		break;
+	case 'x':
+		fullscreen = 1;
+		break;
+	case 'E':
+		shm_name = optarg;
+		break;
+	case 'V':
+		virtual_clock = 1;
+		break;
+	case 'L':
+		latency_mode = 1;
+		break;
+	case 'B':
+		bus_overlay = 1;
+		break;
+	case 'b':
+		bitrate = atol(optarg);
+		break;
+	case 'C':
+		if (sscanf(optarg, "%d,%d", &rx_cpu, &decode_cpu) < 1) Usage("Invalid CPU list");
+		break;
+	case 'P':
+		rt_priority = atoi(optarg);
+		break;
+	case 'M':
+		lock_memory = 1;
+		break;
+	case 'H':
+		if (!strcmp(optarg, "window")) {
+			heatmap_mode = HEATMAP_WINDOW;
+		} else if (!strcmp(optarg, "text")) {
+			heatmap_mode = HEATMAP_TEXT;
+		} else {
+			Usage("The heatmap is either 'window' or 'text'");
+		}
+		break;
 	case 'h':
 	case '?':
 	default:
@@ -512,18 +525,42 @@ int main(int argc, char *argv[]) {
 
   if (seed && randomize) Usage("You can not specify a seed value AND randomize the seed");
 
-  // Verify data directory exists
-  if(stat(DATA_DIR, &dirstat) == -1) {
-  	printf("ERROR: DATA_DIR not found.  Define in make file or run in src dir\n");
-	exit(34);
+  if (dbc_file && (seed || randomize)) Usage("You can not randomize IDs when using a DBC file");
+
+  if (latency_mode && (dbc_file || virtual_clock)) Usage("The latency benchmark needs the fixed IDs and the real clock");
+
+  if (video_file && virtual_clock) Usage("The video is timed on the real clock, it can not be used with -V");
+
+  if (bitrate <= 0) Usage("Invalid bit rate");
+
+  if (rt_priority < 0 || rt_priority > sched_get_priority_max(SCHED_FIFO)) Usage("Invalid SCHED_FIFO priority");
+
+  clock_init(virtual_clock ? CLOCK_DRIVEN : CLOCK_REAL);
+  // The per ID statistics are reported in debug mode, the overlay shows the total
+  busstats_on = debug || bus_overlay;
+  busstats_init(&bus_stats, bitrate, CANFD_DATA_BITRATE);
+  if (heatmap_mode && heatmap_init(&heatmap) < 0) {
+	printf("ERROR: Could not allocate the heatmap\n");
+	exit(8);
+  }
+
+  if (dbc_file) {
+	if (dbc_load(dbc_file, &dbc) < 0) {
+		printf("ERROR: Could not load DBC file %s\n", dbc_file);
+		exit(5);
+	}
+	int bound = bind_dbc_signals(&dbc);
+	active_dbc = &dbc;
+	printf("Loaded %d messages from %s (%d/%d signals used)\n", dbc.nmessages, dbc_file, bound, SIG_COUNT);
   }
-  
+
   // Create a new raw CAN socket
   can = socket(PF_CAN, SOCK_RAW, CAN_RAW);
   if(can < 0) Usage("Couldn't create raw socket");
 
   memset(&ifr.ifr_name, 0, sizeof(ifr.ifr_name));
-  strncpy(ifr.ifr_name, argv[optind], strlen(argv[optind]));
+  strncpy(ifr.ifr_name, argv[optind], IFNAMSIZ - 1);
+  memcpy(can_ifname, ifr.ifr_name, IFNAMSIZ);
   printf("Using CAN interface %s\n", ifr.ifr_name);
   if (ioctl(can, SIOCGIFINDEX, &ifr) < 0) {
     perror("SIOCGIFINDEX");
@@ -533,23 +570,53 @@ int main(int argc, char *argv[]) {
   addr.can_ifindex = ifr.ifr_ifindex;
   // CAN FD Mode
   setsockopt(can, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+  // Error frames of every class, counted in canerr.c
+  can_err_mask_t err_mask = CAN_ERR_MASK;
+  setsockopt(can, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask));
+  // Kernel receive timestamps
+  setsockopt(can, SOL_SOCKET, SO_TIMESTAMP, &canfd_on, sizeof(canfd_on));
+
+  if (flightrec_secs) {
+	if (flightrec_init(&flightrec, flightrec_secs, ifr.ifr_name) < 0) {
+		printf("ERROR: Could not allocate the flight recorder\n");
+		exit(6);
+	}
+	signal(SIGUSR2, request_flightrec_dump);
+	printf("Flight recorder: last %u seconds, kill -USR2 %d to dump to %s\n",
+	       flightrec_secs, (int)getpid(), flightrec_file);
+  }
 
-  iov.iov_base = &frame;
-  iov.iov_len = sizeof(frame);
-  msg.msg_name = &addr;
-  msg.msg_namelen = sizeof(addr);
-  msg.msg_iov = &iov;
-  msg.msg_iovlen = 1;
-  msg.msg_control = &ctrlmsg;
-  msg.msg_controllen = sizeof(ctrlmsg);
-  msg.msg_flags = 0;
+  if (pcap_file) {
+	if (pcapng_open(&pcap, pcap_file, ifr.ifr_name) < 0) {
+		printf("ERROR: Could not create the capture %s\n", pcap_file);
+		exit(11);
+	}
+	printf("Capturing to %s\n", pcap_file);
+  }
 
   if (bind(can, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 	perror("bind");
 	return 1;
   }
-  can_thread = SDL_CreateThread(can_receive_thread, "CANThread", &can);
-
+  if (rxring_init(&rx_ring) < 0) {
+	printf("ERROR: Could not allocate the receive ring\n");
+	exit(9);
+  }
+  shutdown_fd = eventfd(0, EFD_CLOEXEC);
+  if (shutdown_fd < 0) {
+	perror("eventfd");
+	exit(10);
+  }
+  // The decode thread publishes to it
+  if (shm_name) {
+	shm = icsim_shm_create(shm_name);
+	if (!shm) {
+		printf("ERROR: Could not create shared memory %s\n", shm_name);
+		exit(7);
+	}
+  }
+  // Set up the decoders before the threads start: the RX thread reports READY right away
+  // and the decode thread reads the IDs and byte positions without locking
   init_car_state();
 
   if (randomize || seed) {
@@ -575,91 +642,206 @@ int main(int argc, char *argv[]) {
 	}
   }
 
+  // Everything the RX path touches is allocated by now
+  if (lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) perror("WARNING: mlockall");
+  state_mutex = SDL_CreateMutex();
+  canerr_reset(&can_errors);
+  can_thread = SDL_CreateThread(can_receive_thread, "CANThread", &can);
+  decode_thread = SDL_CreateThread(decode_frames, "DecodeThread", &can);
+
   SDL_Window *window = NULL;
   if(SDL_Init ( SDL_INIT_VIDEO ) < 0 ) {
 	printf("SDL Could not initializes\n");
 	exit(40);
   }
   window = SDL_CreateWindow("IC Simulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT,
-                            SDL_WINDOW_SHOWN); // | SDL_WINDOW_RESIZABLE);
+                            SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
   if(window == NULL) {
 	printf("Window could not be shown\n");
   }
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-  SDL_Surface *image = IMG_Load(get_data("ic.png"));
-  SDL_Surface *needle = IMG_Load(get_data("needle.png"));
-  SDL_Surface *sprites = IMG_Load(get_data("spritesheet.png"));
-  SDL_Surface *lock = IMG_Load(get_data("lock.png"));
-  SDL_Surface *unlock = IMG_Load(get_data("unlock.png"));
-  base_texture = SDL_CreateTextureFromSurface(renderer, image);
-  needle_tex = SDL_CreateTextureFromSurface(renderer, needle);
-  sprite_tex = SDL_CreateTextureFromSurface(renderer, sprites);
-  lock_tex = SDL_CreateTextureFromSurface(renderer, lock);
-  unlock_tex = SDL_CreateTextureFromSurface(renderer, unlock);
-
-  speed_rect.x = 212;
-  speed_rect.y = 175;
-  speed_rect.h = needle->h;
-  speed_rect.w = needle->w;
+  SDL_SetWindowMinimumSize(window, SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4);
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+  if (cluster_load(renderer, bus_overlay) < 0) {
+	printf("ERROR: Could not create textures\n");
+	exit(34);
+  }
+
+  if (heatmap_mode == HEATMAP_WINDOW) {
+	heat_window = SDL_CreateWindow("IC Heatmap", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+	                               HEATMAP_WIDTH, HEATMAP_HEIGHT, SDL_WINDOW_SHOWN);
+	if (heat_window) heat_renderer = SDL_CreateRenderer(heat_window, -1, SDL_RENDERER_SOFTWARE);
+	if (!heat_renderer) {
+		printf("ERROR: Could not create the heatmap window: %s\n", SDL_GetError());
+		exit(42);
+	}
+  }
+
+  if (layout_ic() < 0) {
+	printf("ERROR: Could not set up the gauges\n");
+	exit(41);
+  }
+
+  if (shm) {
+	SDL_LockMutex(state_mutex);
+	export_state(&car_state, &sec_ctx, &can_errors);
+	SDL_UnlockMutex(state_mutex);
+  }
 
   // Draw the initial state of the IC
   CarState snapshot = car_state;
-  CarState prev_snapshot = car_state;
-  redraw_ic(&snapshot, &redraw_flags);
-  SDL_RenderPresent(renderer);
-
-  state_mutex = SDL_CreateMutex();
+  CanErrorStats err_snapshot;
+  int input_pending = 0;
+  int relayout = 0;
+  Uint32 input_sent_us = 0;
+  latency_reset(&latency_hist);
+  if (video_file) {
+	if (videorec_open(&video, video_file, ic_view.w, ic_view.h, TARGET_FPS) < 0) {
+		printf("ERROR: Could not create the video %s\n", video_file);
+		exit(12);
+	}
+	printf("Recording %dx%d video to %s\n", video.w, video.h, video_file);
+  }
+  redraw_ic(&snapshot);
+  present_ic();
+  if (video_file) record_video_frame();
+  if (debug) print_startup_stats();
 
   // 2. Handle drawing and events
   while (running) {
-    frame_start = SDL_GetTicks();
+    frame_start = clock_ms();
     while (SDL_PollEvent(&event)) {
       if (event.type == SDL_QUIT) running = 0;
+      // With the heatmap open closing either window only sends a window event
+      if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE) running = 0;
+      // Resizes come in bursts while dragging, the layout is rebuilt once per frame at most
+      if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED &&
+          event.window.windowID == SDL_GetWindowID(window))
+        relayout = 1;
+      if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F11) {
+        fullscreen = !fullscreen;
+        SDL_SetWindowFullscreen(window, fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
+      }
     }
 
     SDL_LockMutex(state_mutex);
     snapshot = car_state;
+    snapshot.bus_load = bus_load;
+    err_snapshot = can_errors;
+    if (latency_pending) {
+      input_pending = 1;
+      input_sent_us = latency_sent_us;
+      latency_pending = 0;
+    }
     SDL_UnlockMutex(state_mutex);
 
-    // 3. Check if the state has changed and redraw if necessary
-    update_redraw_flags(&prev_snapshot, &snapshot, &redraw_flags);
-    if (redraw_flags.speed_redraw || redraw_flags.doors_redraw ||
-       redraw_flags.turn_redraw || redraw_flags.lock_redraw) {
-      redraw_ic(&snapshot, &redraw_flags);
-      SDL_RenderPresent(renderer);
-      prev_snapshot = snapshot;
+    // 3. Redraw the gauges whose state has changed, everything after a resize
+    int drawn;
+    if (relayout) {
+      relayout = 0;
+      if (layout_ic() < 0) {
+        printf("ERROR: Could not lay out the cluster for the new window size\n");
+        break;
+      }
+      redraw_ic(&snapshot);
+      drawn = 1;
+    } else {
+      drawn = update_ic(&snapshot);
+    }
+    if (drawn) {
+      present_ic();
+      if (video_file) record_video_frame();
+      if (input_pending) {
+        record_latency(input_sent_us);
+        input_pending = 0;
+      }
     }
 
-    // 4. Update the lock status if it is ON
-    if (snapshot.lock_status == OFF) {
-      Uint32 now = SDL_GetTicks();
-      if (now - snapshot.unlock_time > 30000) {  // 30 seconds
-        SDL_LockMutex(state_mutex);
-        car_state.lock_status = ON;
-        SDL_UnlockMutex(state_mutex);
-        printf("[TIMEOUT] Auto-lock after 30 seconds of inactivity\n");
+    // Dump the flight recorder on a writer thread, the display keeps running
+    if (flightrec_dump_requested) {
+      flightrec_dump_requested = 0;
+      size_t len = strlen(flightrec_file);
+      int binary = len > 4 && !strcmp(flightrec_file + len - 4, ".bin");
+      int busy = flightrec_dump_async(&flightrec, flightrec_file, binary);
+      if (busy > 0) printf("[FLIGHTREC] Still writing the previous dump, request ignored\n");
+      if (busy < 0) printf("WARNING: Could not start the flight recorder dump\n");
+    }
+
+    // Bus load overlay and the per ID report, outside of the RX path
+    if (bus_overlay && clock_ms() - bus_sampled >= BUSSTATS_SAMPLE_MS) {
+      bus_sampled = clock_ms();
+      bus_load = sample_bus_load();
+    }
+    if (debug && clock_ms() - bus_reported >= BUSSTATS_REPORT_MS) {
+      bus_reported = clock_ms();
+      SDL_LockMutex(state_mutex);
+      busstats_window(&bus_stats, &bus_window);
+      SDL_UnlockMutex(state_mutex);
+      busstats_print(&bus_window);
+      canerr_print(&err_snapshot);
+    }
+
+    if (heatmap_mode && clock_ms() - heat_shown >= HEATMAP_WINDOW_MS) {
+      heat_shown = clock_ms();
+      SDL_LockMutex(state_mutex);
+      int rows = heatmap_window(&heatmap, heat_rows);
+      SDL_UnlockMutex(state_mutex);
+      heatmap_sort(heat_rows, rows);
+      if (heatmap_mode == HEATMAP_TEXT) {
+        heatmap_print(heat_rows, rows);
+      } else {
+        heatmap_render(heat_renderer, heat_rows, rows);
       }
     }
 
+    // 4. Update the lock status if it is ON
+    if (snapshot.lock_status == OFF && !virtual_clock) {
+      SDL_LockMutex(state_mutex);
+      int locked = check_auto_lock(clock_ms());
+      if (locked && shm) export_state(&car_state, &sec_ctx, &can_errors);
+      SDL_UnlockMutex(state_mutex);
+      if (locked) printf("[TIMEOUT] Auto-lock after 30 seconds of inactivity\n");
+    }
+
     // 5. Delay to maintain target FPS
-    frame_time = SDL_GetTicks() - frame_start;
+    // Under -V time only moves with the traffic, the display is paced at a plain 60 fps
+    frame_time = virtual_clock ? 0 : clock_ms() - frame_start;
     if (frame_time < FRAME_DELAY_MS) {
-      SDL_Delay(FRAME_DELAY_MS - frame_time);
+      clock_delay(FRAME_DELAY_MS - frame_time);
     }
   }
 
-  SDL_WaitThread(can_thread, NULL);
+  stop_threads();
+  if (debug) canerr_print(&can_errors);
+  if (debug) print_security_stats();
+  if (debug && rx_ring.dropped) printf("[DEBUG] %lu frames dropped by a full receive ring\n", (unsigned long)rx_ring.dropped);
+  rxring_free(&rx_ring);
+  if (pcap_file) {
+	uint64_t frames = pcap.frames, dropped = pcap.dropped;
+	if (pcapng_close(&pcap) < 0) printf("WARNING: The capture %s is incomplete\n", pcap_file);
+	printf("[PCAPNG] Wrote %lu frames to %s", (unsigned long)frames, pcap_file);
+	if (dropped) printf(", %lu dropped by a slow disk", (unsigned long)dropped);
+	printf("\n");
+  }
+  if (video_file) {
+	unsigned long late = video.late;
+	if (videorec_close(&video) < 0) printf("WARNING: The video %s is incomplete\n", video_file);
+	printf("[VIDEO] Wrote %lu frames (%lu repeats of an unchanged display) to %s\n",
+	       (unsigned long)video.frames, (unsigned long)video.repeated, video_file);
+	if (late) printf("WARNING: %lu frames were presented while the video writer was behind\n", late);
+	if (video_frame) SDL_DestroyTexture(video_frame);
+  }
+  close(shutdown_fd);
+  if (latency_mode) print_latency(debug);
   SDL_DestroyMutex(state_mutex);
-  SDL_DestroyTexture(base_texture);
-  SDL_DestroyTexture(needle_tex);
-  SDL_DestroyTexture(sprite_tex);
-  SDL_FreeSurface(image);
-  SDL_FreeSurface(needle);
-  SDL_FreeSurface(sprites);
-  SDL_FreeSurface(lock);
-  SDL_FreeSurface(unlock);
+  cluster_free();
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
+  if (heat_renderer) SDL_DestroyRenderer(heat_renderer);
+  if (heat_window) SDL_DestroyWindow(heat_window);
+  if (heatmap_mode) heatmap_free(&heatmap);
+  if (dbc_file) dbc_free(&dbc);
+  if (flightrec_secs) flightrec_free(&flightrec);
+  if (shm) icsim_shm_destroy(shm, shm_name);
   IMG_Quit();
   SDL_Quit();
 
@@ -4,7 +4,13 @@
 #include <stdint.h>
 #include <SDL2/SDL.h>
 #include <linux/can.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
+#include "dbc.h"
+#include "layout.h"
+#include "canerr.h"
+#include "uds.h"
 
 /* === Constants === */
 
@@ -40,18 +46,38 @@
 #define MODEL_BMW_X1_SPEED_ID 0x1B4
 #define MODEL_BMW_X1_SPEED_BYTE 0
 #define MODEL_BMW_X1_RPM_ID 0x0AA
-#define MODEL_BMW_X1_RPM_BYTE 4
+#define MODEL_BMW_X1_RPM_BYTE 4       // bytes 4,5 little endian, rpm * 4
+#define MODEL_BMW_X1_HANDBRAKE_ID 0x1B4
+#define MODEL_BMW_X1_HANDBRAKE_BYTE 5
+#define MODEL_BMW_X1_HANDBRAKE_BIT 0x02
 
 // Display refresh rate
 #define TARGET_FPS 60
 #define FRAME_DELAY_MS (1000 / TARGET_FPS)
 
-// UDS (Unified Diagnostic Services)
-#define UDS_SECURITY_REQ       0x27
-#define UDS_SECURITY_REQ_SEED  0x01
-#define UDS_SECURITY_REQ_KEY   0x02
-#define UDS_DIAG_ID            0x7DF
+// Frames read per wakeup of the RX thread
+#define RX_BATCH 64
+
+// UDS (Unified Diagnostic Services), see uds.h for the protocol constants
 #define EXPECTED_KEY           0x5A
+#define AUTO_LOCK_MS           30000 // Relock 30 seconds after a successful unlock
+#define UDS_MAX_ATTEMPTS       3     // Invalid keys before the delay timer starts
+#define UDS_ATTEMPT_DELAY_MS   10000 // Seeds are refused this long after the last attempt
+#define UDS_RESPONSE_RATE      1000  // Responses per second and tester, more are ignored
+#define UDS_RESPONSE_BURST     50
+
+
+// DBC signals that drive the car state (names in dbc_signal_names, icsim.c)
+#define SIG_SPEED 0
+#define SIG_TURN_LEFT 1
+#define SIG_TURN_RIGHT 2
+#define SIG_DOOR_FL 3
+#define SIG_DOOR_FR 4
+#define SIG_DOOR_RL 5
+#define SIG_DOOR_RR 6
+#define SIG_RPM 7
+#define SIG_HANDBRAKE 8
+#define SIG_COUNT 9
 
 
 /* === Structures === */
@@ -59,20 +85,15 @@
 // Define the car state structure
 typedef struct {
   long speed;
+  long rpm;
   int door_status[4];
   int turn_status[2];
+  int handbrake;   // ON / OFF
   int lock_status; // ON / OFF
   Uint32 unlock_time; 
+  int bus_load;    // Percent of the bus time in use (icsim -B)
 } CarState;
 
-// Define the redraw flags structure
-typedef struct {
-  int speed_redraw;
-  int doors_redraw;
-  int turn_redraw;
-  int lock_redraw;
-} RedrawFlags;
-
 // Security context (UDS SecurityAccess)
 typedef enum {
   SEC_STATE_LOCKED_NO_SEED = 0,     // A: 全ロック・シード未発行
@@ -86,12 +107,25 @@ typedef struct {
   Uint8 seed;
   Uint32 seed_sent_time;
   Uint32 timeout_ms;
+  int attempts;          // Invalid keys since the last valid one or lockout
+  Uint32 delay_until;    // Seeds are refused with NRC 0x37 until then
+  Uint32 tokens;         // Response token bucket, in thousandths of a token
+  Uint32 refill_time;
+  unsigned long dropped; // Requests ignored by the rate limit
+  unsigned long lockouts;
 } SecurityContext;
 
 /* === Global Variables（See icsim.c）=== */
 
 extern CarState car_state;
-extern SDL_Renderer *renderer;
+extern SecurityContext sec_ctx;
+
+// Decoder configuration (See decode.c)
+extern int debug;
+extern int door_pos, signal_pos, speed_pos;
+extern canid_t door_id, signal_id, speed_id;
+extern char *model;
+extern DbcDatabase *active_dbc; // NULL to use the fixed IDs above
 
 /* === Prototypes === */
 
@@ -102,27 +136,39 @@ void init_car_state(void);
 void update_speed_status(struct canfd_frame *cf, int maxdlen);
 void update_door_status(struct canfd_frame *cf, int maxdlen);
 void update_signal_status(struct canfd_frame *cf, int maxdlen);
+void update_rpm_status(struct canfd_frame *cf, int maxdlen);
+void update_handbrake_status(struct canfd_frame *cf, int maxdlen);
+void update_layout_status(const FrameLayout *layout, struct canfd_frame *cf, int maxdlen);
 void update_security_status(struct canfd_frame *cf, int maxdlen, int can_fd, SecurityContext* ctx);
+void update_dbc_status(const DbcMessage *msg, struct canfd_frame *cf);
+void decode_frame(struct canfd_frame *cf, int maxdlen, int can_fd);
+int decode_wants(canid_t id);
+int check_auto_lock(Uint32 now);
 
-// Rendering functions
-void blank_ic(void);
-void update_speed(CarState* state);
-void update_doors(CarState* state);
-void update_turn_signals(CarState* state);
-void update_lock_icon(CarState* state);
-void redraw_ic(CarState* snapshot, RedrawFlags* flags);
-
-//  Redraw flags
-void update_redraw_flags(CarState* prev, CarState* curr, RedrawFlags* flags);
+// DBC signal definitions
+int bind_dbc_signals(DbcDatabase *db);
 
 // UDS (Unified Diagnostic Services)
 int send_can_response(uint32_t can_id, uint8_t* data, uint8_t len, int can_fd);
-int send_canfd_response(uint32_t can_id, uint8_t* data, uint8_t len, int can_fd);
+int send_canfd_response(uint32_t can_id, uint8_t* data, uint8_t len, uint8_t flags, int can_fd);
 Uint8 generate_seed(void);
-void calculate_key(Uint8 seed, Uint8* key_out);
+void print_security_stats(void);
+
+// Flight recorder
+void frame_timestamp(struct msghdr *msg, struct timeval *tv);
+void request_flightrec_dump(int sig);
+
+// Latency benchmark (see latency.h)
+void track_latency_tag(struct canfd_frame *cf);
+void record_latency(Uint32 sent_us);
+void print_latency(int buckets);
+
+// Shared memory export (see icsim_shm.h)
+void export_state(CarState *state, SecurityContext *sec, CanErrorStats *err);
 
 // Utility functions
 char* get_data(char *fname);
+void print_startup_stats(void);
 void Usage(char *msg);
 
 #endif // ICSIM_H
@@ -0,0 +1,122 @@
+/*
+ * Shared memory export of the live cluster state
+ *
+ * A single writer (icsim) updates the state under a seqlock so any number
+ * of readers can take consistent snapshots without blocking it.  Each
+ * update bumps a generation counter that readers can sleep on with a
+ * futex instead of polling.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "icsim_shm.h"
+
+static long futex(const _Atomic uint32_t *addr, int op, uint32_t val,
+                  const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* Creates (or takes over) the segment, returns NULL on error */
+IcsimShm *icsim_shm_create(const char *name) {
+  IcsimShm *shm;
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+  if (fd < 0) {
+    perror("shm_open");
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(IcsimShm)) < 0) {
+    perror("ftruncate");
+    close(fd);
+    return NULL;
+  }
+  shm = mmap(NULL, sizeof(IcsimShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  memset(&shm->state, 0, sizeof(shm->state));
+  shm->version = ICSIM_SHM_VERSION;
+  shm->size = sizeof(IcsimShm);
+  atomic_store(&shm->seq, 0);
+  atomic_store(&shm->generation, 0);
+  atomic_thread_fence(memory_order_release);
+  shm->magic = ICSIM_SHM_MAGIC;
+  return shm;
+}
+
+/* Publishes a new state and wakes readers waiting for a change */
+void icsim_shm_publish(IcsimShm *shm, const IcsimShmState *state) {
+  uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&shm->state, state, sizeof(*state));
+  atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+
+  atomic_fetch_add_explicit(&shm->generation, 1, memory_order_release);
+  futex(&shm->generation, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void icsim_shm_destroy(IcsimShm *shm, const char *name) {
+  munmap(shm, sizeof(IcsimShm));
+  shm_unlink(name);
+}
+
+/* Maps an existing segment read-only, returns NULL on error */
+IcsimShm *icsim_shm_open(const char *name) {
+  IcsimShm *shm;
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd < 0) return NULL;
+  shm = mmap(NULL, sizeof(IcsimShm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) return NULL;
+  if (shm->magic != ICSIM_SHM_MAGIC || shm->version != ICSIM_SHM_VERSION) {
+    fprintf(stderr, "icsim_shm: %s has an unknown layout\n", name);
+    munmap(shm, sizeof(IcsimShm));
+    return NULL;
+  }
+  return shm;
+}
+
+/* Copies a consistent snapshot, returns the generation it belongs to */
+uint32_t icsim_shm_read(const IcsimShm *shm, IcsimShmState *out) {
+  uint32_t before, after, generation;
+
+  do {
+    generation = atomic_load_explicit(&shm->generation, memory_order_acquire);
+    before = atomic_load_explicit(&shm->seq, memory_order_acquire);
+    memcpy(out, (const void *)&shm->state, sizeof(*out));
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  return generation;
+}
+
+/* Sleeps until the generation moves past the given one.
+ * Returns 0 on change, -1 on timeout or error. timeout_ms < 0 waits forever */
+int icsim_shm_wait(const IcsimShm *shm, uint32_t generation, int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+  while (atomic_load_explicit(&shm->generation, memory_order_acquire) == generation) {
+    long ret = futex(&shm->generation, FUTEX_WAIT, generation, (timeout_ms < 0) ? NULL : &ts);
+    if (ret < 0 && errno == ETIMEDOUT) return -1;
+    if (ret < 0 && errno != EAGAIN && errno != EINTR) return -1;
+  }
+  return 0;
+}
+
+void icsim_shm_close(IcsimShm *shm) { munmap(shm, sizeof(IcsimShm)); }
@@ -0,0 +1,75 @@
+#ifndef ICSIM_SHM_H
+#define ICSIM_SHM_H
+
+/*
+ * Live cluster state exported by icsim (-E) through POSIX shared memory.
+ *
+ * Readers do not need SDL or a CAN socket: open the segment, then read
+ * consistent snapshots and wait for changes.
+ *
+ *   IcsimShm *shm = icsim_shm_open(ICSIM_SHM_DEFAULT_NAME);
+ *   IcsimShmState st;
+ *   uint32_t gen = icsim_shm_read(shm, &st);
+ *   while (icsim_shm_wait(shm, gen, -1) >= 0) gen = icsim_shm_read(shm, &st);
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+#define ICSIM_SHM_DEFAULT_NAME "/icsim"
+#define ICSIM_SHM_MAGIC 0x4D485349 // "ISHM"
+#define ICSIM_SHM_VERSION 3
+
+/* === Structures === */
+
+// Mirror of CarState, SecurityContext (icsim.h) and the error frame
+// counters (canerr.h) with fixed-size types
+typedef struct {
+  int64_t speed;
+  int64_t rpm;
+  int32_t door_status[4]; // DOOR_LOCKED / DOOR_UNLOCKED
+  int32_t turn_status[2]; // OFF / ON
+  int32_t handbrake;
+  int32_t lock_status;
+  uint32_t unlock_time;
+  int32_t security_state; // SecurityState
+  uint32_t seed;
+  uint32_t seed_sent_time;
+  uint32_t timeout_ms;
+  uint32_t reserved;
+  uint64_t err_frames; // CAN error frames received
+  uint64_t err_bus_off;
+  uint64_t err_passive;
+  uint64_t err_lost_arbitration;
+  uint64_t err_protocol;
+  uint64_t err_rx_overflow;
+  uint64_t err_tx_overflow;
+  uint64_t err_fd_esi; // CAN FD frames with the error state indicator set
+} IcsimShmState;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;               // sizeof(IcsimShm) of the writer
+  _Atomic uint32_t seq;        // Seqlock, odd while the state is being written
+  _Atomic uint32_t generation; // Bumped after every update, futex word
+  uint32_t reserved;
+  IcsimShmState state;
+} IcsimShm;
+
+/* === Prototypes === */
+
+// Writer side (icsim)
+IcsimShm *icsim_shm_create(const char *name);
+void icsim_shm_publish(IcsimShm *shm, const IcsimShmState *state);
+void icsim_shm_destroy(IcsimShm *shm, const char *name);
+
+// Reader side
+IcsimShm *icsim_shm_open(const char *name);
+uint32_t icsim_shm_read(const IcsimShm *shm, IcsimShmState *out);
+int icsim_shm_wait(const IcsimShm *shm, uint32_t generation, int timeout_ms);
+void icsim_shm_close(IcsimShm *shm);
+
+#endif // ICSIM_SHM_H
@@ -0,0 +1,96 @@
+/*
+ * Input-to-pixel latency tags and histogram
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+uint32_t latency_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/* Offsets of the free bytes, returns how many were found (at most LATENCY_TAG_LEN) */
+static int tag_bytes(int len, uint32_t used, int *pos) {
+  int n = 0;
+  for (int i = 0; i < len && n < LATENCY_TAG_LEN; i++)
+    if (!(used & (1U << i))) pos[n++] = i;
+  return n;
+}
+
+int latency_pack(uint8_t *data, int len, uint32_t used, uint8_t seq, uint32_t usec) {
+  int pos[LATENCY_TAG_LEN];
+
+  if (tag_bytes(len, used, pos) < LATENCY_TAG_LEN) return -1;
+  data[pos[0]] = seq;
+  for (int i = 0; i < 4; i++) data[pos[i + 1]] = (usec >> (8 * i)) & 0xff;
+  return 0;
+}
+
+int latency_unpack(const uint8_t *data, int len, uint32_t used, uint8_t *seq, uint32_t *usec) {
+  int pos[LATENCY_TAG_LEN];
+
+  if (tag_bytes(len, used, pos) < LATENCY_TAG_LEN) return -1;
+  *seq = data[pos[0]];
+  *usec = 0;
+  for (int i = 0; i < 4; i++) *usec |= (uint32_t)data[pos[i + 1]] << (8 * i);
+  return 0;
+}
+
+/* Values below 16 get their own bucket, then 8 buckets per power of two */
+static int bucket_of(uint32_t v) {
+  if (v < 16) return v;
+  int b = 31 - __builtin_clz(v);
+  return (b - LATENCY_SUB_BITS) * 8 + ((v >> (b - LATENCY_SUB_BITS)) & 7) + 8;
+}
+
+static uint32_t bucket_low(int idx) {
+  if (idx < 16) return idx;
+  int k = idx - 8;
+  return (uint32_t)(8 + k % 8) << (k / 8);
+}
+
+void latency_reset(LatencyHist *h) {
+  memset(h, 0, sizeof(*h));
+  h->min = UINT32_MAX;
+}
+
+void latency_add(LatencyHist *h, uint32_t usec) {
+  h->count++;
+  h->sum += usec;
+  if (usec < h->min) h->min = usec;
+  if (usec > h->max) h->max = usec;
+  h->buckets[bucket_of(usec)]++;
+}
+
+/* Lower bound of the bucket holding the given percentile */
+uint32_t latency_percentile(const LatencyHist *h, double pct) {
+  uint64_t want = (uint64_t)(h->count * pct / 100.0 + 0.5), seen = 0;
+
+  if (want == 0) want = 1;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= want) return bucket_low(i);
+  }
+  return h->max;
+}
+
+void latency_print(const LatencyHist *h, const char *label, int buckets) {
+  if (h->count == 0) {
+    printf("[LATENCY] %s: no samples\n", label);
+    return;
+  }
+  printf("[LATENCY] %s: n=%llu min=%u mean=%llu p50=%u p90=%u p99=%u p99.9=%u max=%u us\n", label,
+         (unsigned long long)h->count, h->min, (unsigned long long)(h->sum / h->count),
+         latency_percentile(h, 50), latency_percentile(h, 90), latency_percentile(h, 99),
+         latency_percentile(h, 99.9), h->max);
+  if (!buckets) return;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    if (h->buckets[i])
+      printf("  %8u us  %u\n", bucket_low(i), h->buckets[i]);
+  }
+}
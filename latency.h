@@ -0,0 +1,47 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+ * End-to-end latency measurement between controls and icsim (-L).
+ *
+ * controls writes a sequence number and a CLOCK_MONOTONIC timestamp into the
+ * padding bytes of its speed frames.  icsim reads them back and, when the
+ * frame carrying a new sequence number has been drawn, records how long it
+ * took from the input to SDL_RenderPresent() returning.
+ */
+
+#include <stdint.h>
+
+/* === Constants === */
+
+#define LATENCY_TAG_LEN 5        // Sequence (1 byte) + microseconds (4 bytes)
+#define LATENCY_SUB_BITS 3       // 8 buckets per power of two, ~12% resolution
+#define LATENCY_BUCKETS 240      // Covers the full 32-bit microsecond range
+#define LATENCY_REPORT_EVERY 500 // Samples between icsim reports
+
+/* === Structures === */
+
+// Log-linear histogram of latencies in microseconds
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  uint32_t buckets[LATENCY_BUCKETS];
+} LatencyHist;
+
+/* === Prototypes === */
+
+uint32_t latency_now_us(void);
+
+// Tags use the bytes of data[0..len) that are not set in used (bit n = byte n).
+// Both return -1 when fewer than LATENCY_TAG_LEN bytes are free.
+int latency_pack(uint8_t *data, int len, uint32_t used, uint8_t seq, uint32_t usec);
+int latency_unpack(const uint8_t *data, int len, uint32_t used, uint8_t *seq, uint32_t *usec);
+
+void latency_reset(LatencyHist *h);
+void latency_add(LatencyHist *h, uint32_t usec);
+uint32_t latency_percentile(const LatencyHist *h, double pct);
+void latency_print(const LatencyHist *h, const char *label, int buckets);
+
+#endif // LATENCY_H
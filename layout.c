@@ -0,0 +1,29 @@
+/*
+ * Frame layouts for packed signals (controls -A)
+ */
+
+#include <string.h>
+
+#include "layout.h"
+
+const FrameLayout frame_layouts[] = {
+  // Everything in one classic frame, 2 bytes to spare
+  {.name = "classic", .id = 0x1E0, .fd = 0, .len = 6, .cycle_ms = 100, .pos = {0, 1, 2}},
+  // One 48 byte FD frame, fields spaced like three separate messages
+  {.name = "fd", .id = 0x1F0, .fd = 1, .len = 48, .cycle_ms = 100, .pos = {0, 16, 32}},
+  // Smallest FD frame holding the fields
+  {.name = "fd-compact", .id = 0x1F1, .fd = 1, .len = 8, .cycle_ms = 100, .pos = {0, 1, 2}},
+};
+const int num_frame_layouts = sizeof(frame_layouts) / sizeof(frame_layouts[0]);
+
+const FrameLayout *layout_find(const char *name) {
+  for (int i = 0; i < num_frame_layouts; i++)
+    if (!strcmp(frame_layouts[i].name, name)) return &frame_layouts[i];
+  return NULL;
+}
+
+const FrameLayout *layout_by_id(canid_t id) {
+  for (int i = 0; i < num_frame_layouts; i++)
+    if (frame_layouts[i].id == id) return &frame_layouts[i];
+  return NULL;
+}
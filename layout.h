@@ -0,0 +1,35 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <linux/can.h>
+
+/* === Constants === */
+
+// Signals that can be packed into a shared frame
+#define LAYOUT_DOOR 0   // 1 byte, CAN_DOORn_LOCK bits
+#define LAYOUT_SIGNAL 1 // 1 byte, CAN_LEFT_SIGNAL / CAN_RIGHT_SIGNAL
+#define LAYOUT_SPEED 2  // 2 bytes in the encoding of the model
+#define LAYOUT_FIELDS 3
+
+/* === Structures === */
+
+// One aggregated frame.  controls sends it when a field changes or when the
+// cycle time has passed, whichever comes first; icsim decodes it by ID.
+typedef struct {
+  const char *name;
+  canid_t id;
+  int fd;                 // Sent as CAN FD with BRS
+  int len;                // Payload bytes
+  int cycle_ms;           // Resent at least this often
+  int pos[LAYOUT_FIELDS]; // Byte offset of each field
+} FrameLayout;
+
+/* === Prototypes === */
+
+extern const FrameLayout frame_layouts[];
+extern const int num_frame_layouts;
+
+const FrameLayout *layout_find(const char *name);
+const FrameLayout *layout_by_id(canid_t id);
+
+#endif // LAYOUT_H
@@ -0,0 +1,279 @@
+/*
+ * Sparse timestamp index for candump logs
+ *
+ * Every LOGINDEX_STRIDE bytes of the log the index notes the first line
+ * starting after the boundary and its timestamp.  Seeking binary searches
+ * the checkpoints and then reads at most about one stride of lines, so
+ * jumping into a 10 GB capture touches a few pages instead of the whole file.
+ *
+ * Building only visits the lines at stride boundaries.  The log is split into
+ * stride aligned chunks that are indexed by one thread each, which keeps a
+ * cold capture on slow storage from being read one page fault at a time.
+ * The mapping is advised MADV_RANDOM while building: with the default fault
+ * read-around (read_ahead_kb, often several MiB) touching one line per stride
+ * would read the whole file.
+ *
+ * The sidecar is a cache in host byte order: a header followed by the
+ * checkpoints.  It is rebuilt whenever the size or mtime of the log changes.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logindex.h"
+
+typedef struct {
+  char magic[8];
+  uint32_t stride;
+  uint32_t reserved;
+  uint64_t log_size;
+  int64_t log_mtime;
+  uint64_t first_ts_us;
+  uint64_t count;
+} LogIndexHeader;
+
+typedef struct {
+  const char *log;
+  size_t size;
+  size_t start, end; // Lines starting in [start, end)
+  LogCheckpoint *out;
+  size_t count;
+} ChunkJob;
+
+int logindex_parse_ts(const char *p, const char *end, uint64_t *ts_us) {
+  uint64_t sec = 0, usec = 0;
+  int digits = 0;
+
+  if (p >= end || *p++ != '(') return -1;
+  if (p >= end || *p < '0' || *p > '9') return -1;
+  while (p < end && *p >= '0' && *p <= '9') sec = sec * 10 + (*p++ - '0');
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (digits++ < 6) usec = usec * 10 + (*p - '0');
+    }
+  }
+  for (; digits < 6; digits++) usec *= 10;
+  if (p >= end || *p != ')') return -1;
+  *ts_us = sec * 1000000 + usec;
+  return 0;
+}
+
+int logindex_parse_offset(const char *s, uint64_t *usec) {
+  double total = 0;
+  char *end;
+
+  for (;;) {
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    total = total * 60 + v;
+    if (*end != ':') break;
+    s = end + 1;
+  }
+  if (*end) return -1;
+  *usec = (uint64_t)(total * 1e6);
+  return 0;
+}
+
+/* Start of the first line at or after pos */
+static size_t line_start(const char *log, size_t size, size_t pos) {
+  if (pos == 0 || pos >= size) return pos;
+  if (log[pos - 1] == '\n') return pos;
+  const char *nl = memchr(log + pos, '\n', size - pos);
+  return nl ? (size_t)(nl - log) + 1 : size;
+}
+
+static size_t next_line(const char *log, size_t size, size_t pos) {
+  const char *nl = memchr(log + pos, '\n', size - pos);
+  return nl ? (size_t)(nl - log) + 1 : size;
+}
+
+static void *index_chunk(void *arg) {
+  ChunkJob *job = arg;
+  size_t pos = line_start(job->log, job->size, job->start);
+
+  while (pos < job->end) {
+    size_t eol = next_line(job->log, job->size, pos);
+    uint64_t ts;
+
+    if (logindex_parse_ts(job->log + pos, job->log + eol, &ts) < 0) {
+      pos = eol; // Comment or damaged line, the next one takes the checkpoint
+      continue;
+    }
+    job->out[job->count].ts_us = ts;
+    job->out[job->count].offset = pos;
+    job->count++;
+    // Skip the rest of the stride without looking at it
+    pos = line_start(job->log, job->size, (pos / LOGINDEX_STRIDE + 1) * LOGINDEX_STRIDE);
+  }
+  return NULL;
+}
+
+int logindex_build(const char *log, size_t size, int threads, LogIndex *idx) {
+  size_t strides = size / LOGINDEX_STRIDE + 1;
+  ChunkJob jobs[LOGINDEX_MAX_THREADS];
+  pthread_t tids[LOGINDEX_MAX_THREADS];
+  size_t chunk;
+
+  memset(idx, 0, sizeof(*idx));
+  idx->log_size = size;
+  if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > LOGINDEX_MAX_THREADS) threads = LOGINDEX_MAX_THREADS;
+  if ((size_t)threads > strides) threads = strides;
+  chunk = (strides + threads - 1) / threads * LOGINDEX_STRIDE;
+
+  idx->entries = malloc(strides * sizeof(LogCheckpoint));
+  if (!idx->entries) return -1;
+
+  // Only fault in the pages that are read, the log may not be a mapping at all
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  void *map = (void *)((uintptr_t)log & ~(page - 1));
+  size_t map_len = log + size - (const char *)map;
+  if (size) madvise(map, map_len, MADV_RANDOM);
+
+  // Every chunk writes into its own part of the table, no merging needed
+  for (int i = 0; i < threads; i++) {
+    ChunkJob *job = &jobs[i];
+    job->log = log;
+    job->size = size;
+    job->start = i * chunk;
+    job->end = (job->start + chunk < size) ? job->start + chunk : size;
+    job->out = idx->entries + job->start / LOGINDEX_STRIDE;
+    job->count = 0;
+    if (job->start >= size) continue;
+    if (i > 0 && pthread_create(&tids[i], NULL, index_chunk, job) != 0) index_chunk(job);
+  }
+  if (size) index_chunk(&jobs[0]);
+  for (int i = 1; i < threads; i++)
+    if (jobs[i].start < size) pthread_join(tids[i], NULL);
+  if (size) madvise(map, map_len, MADV_NORMAL);
+
+  // Compact the chunks and keep the timestamps sorted if the log steps backwards
+  for (int i = 0; i < threads; i++) {
+    for (size_t j = 0; j < jobs[i].count; j++) {
+      LogCheckpoint cp = jobs[i].out[j];
+      if (idx->count && cp.ts_us < idx->entries[idx->count - 1].ts_us)
+        cp.ts_us = idx->entries[idx->count - 1].ts_us;
+      idx->entries[idx->count++] = cp;
+    }
+  }
+  if (idx->count) {
+    // The first checkpoint is the first timestamped line of the log
+    uint64_t ts = 0;
+    logindex_parse_ts(log + idx->entries[0].offset, log + size, &ts);
+    idx->first_ts_us = ts;
+  }
+  return 0;
+}
+
+int logindex_save(const LogIndex *idx, const char *path) {
+  char tmp[4096];
+  LogIndexHeader hdr;
+  FILE *fp;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fp = fopen(tmp, "wb");
+  if (!fp) {
+    perror(tmp);
+    return -1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, LOGINDEX_MAGIC, sizeof(hdr.magic));
+  hdr.stride = LOGINDEX_STRIDE;
+  hdr.log_size = idx->log_size;
+  hdr.log_mtime = idx->log_mtime;
+  hdr.first_ts_us = idx->first_ts_us;
+  hdr.count = idx->count;
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      fwrite(idx->entries, sizeof(LogCheckpoint), idx->count, fp) != idx->count || fclose(fp) != 0) {
+    perror(tmp);
+    unlink(tmp);
+    return -1;
+  }
+  // Readers never see a half written sidecar
+  if (rename(tmp, path) < 0) {
+    perror(path);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int logindex_load(const char *path, uint64_t log_size, int64_t log_mtime, LogIndex *idx) {
+  FILE *fp = fopen(path, "rb");
+  LogIndexHeader hdr;
+
+  memset(idx, 0, sizeof(*idx));
+  if (!fp) return -1;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, LOGINDEX_MAGIC, sizeof(hdr.magic)) ||
+      hdr.stride != LOGINDEX_STRIDE || hdr.log_size != log_size || hdr.log_mtime != log_mtime ||
+      hdr.count > log_size / LOGINDEX_STRIDE + 1) {
+    fclose(fp);
+    return -1;
+  }
+  idx->entries = malloc((hdr.count ? hdr.count : 1) * sizeof(LogCheckpoint));
+  if (!idx->entries || fread(idx->entries, sizeof(LogCheckpoint), hdr.count, fp) != hdr.count) {
+    fclose(fp);
+    logindex_free(idx);
+    return -1;
+  }
+  fclose(fp);
+  idx->log_size = hdr.log_size;
+  idx->log_mtime = hdr.log_mtime;
+  idx->first_ts_us = hdr.first_ts_us;
+  idx->count = hdr.count;
+  return 0;
+}
+
+int logindex_open(const char *log_path, const char *log, size_t size, int threads, LogIndex *idx) {
+  char path[4096];
+  struct stat st;
+
+  if (stat(log_path, &st) < 0) {
+    perror(log_path);
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%s%s", log_path, LOGINDEX_SUFFIX);
+  if (logindex_load(path, size, st.st_mtime, idx) == 0) return 0;
+
+  if (logindex_build(log, size, threads, idx) < 0) return -1;
+  idx->log_mtime = st.st_mtime;
+  // A read only capture directory still gets a working, if unsaved, index
+  if (logindex_save(idx, path) < 0) fprintf(stderr, "Could not save the index %s\n", path);
+  return 0;
+}
+
+void logindex_free(LogIndex *idx) {
+  free(idx->entries);
+  idx->entries = NULL;
+  idx->count = 0;
+}
+
+size_t logindex_seek(const LogIndex *idx, const char *log, size_t size, uint64_t ts_us) {
+  size_t lo = 0, hi = idx->count, pos = 0;
+
+  // Last checkpoint at or before ts_us
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].ts_us <= ts_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo > 0) pos = idx->entries[lo - 1].offset;
+
+  while (pos < size) {
+    size_t eol = next_line(log, size, pos);
+    uint64_t ts;
+    if (logindex_parse_ts(log + pos, log + eol, &ts) == 0 && ts >= ts_us) return pos;
+    pos = eol;
+  }
+  return size;
+}
@@ -0,0 +1,48 @@
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+#define LOGINDEX_MAGIC "ICSIDX1"      // Sidecar header, NUL terminated
+#define LOGINDEX_SUFFIX ".idx"        // Sidecar file name is the log name plus this
+#define LOGINDEX_STRIDE (1024 * 1024) // Log bytes between checkpoints
+#define LOGINDEX_MAX_THREADS 64
+
+/* === Structures === */
+
+// First line starting at or after a stride boundary
+typedef struct {
+  uint64_t ts_us;  // Highest timestamp up to this line, so the table stays sorted
+  uint64_t offset; // Start of the line in the log
+} LogCheckpoint;
+
+typedef struct {
+  uint64_t log_size;
+  int64_t log_mtime; // Seconds, the sidecar is rebuilt when the log changes
+  uint64_t first_ts_us;
+  LogCheckpoint *entries;
+  size_t count;
+} LogIndex;
+
+/* === Prototypes === */
+
+// Scans the log in parallel, threads <= 0 uses every online CPU
+int logindex_build(const char *log, size_t size, int threads, LogIndex *idx);
+int logindex_save(const LogIndex *idx, const char *path);
+// Fails when the sidecar is missing, damaged or does not match the log
+int logindex_load(const char *path, uint64_t log_size, int64_t log_mtime, LogIndex *idx);
+// Loads the sidecar of log_path, or builds and saves it when it is stale or missing
+int logindex_open(const char *log_path, const char *log, size_t size, int threads, LogIndex *idx);
+void logindex_free(LogIndex *idx);
+
+// Offset of the first line at or after ts_us, size when there is none
+size_t logindex_seek(const LogIndex *idx, const char *log, size_t size, uint64_t ts_us);
+// Parses "(seconds.micros)" at p, returns -1 when the line has no timestamp
+int logindex_parse_ts(const char *p, const char *end, uint64_t *ts_us);
+// Parses a [[HH:]MM:]SS[.frac] start time, -1 on error
+int logindex_parse_offset(const char *s, uint64_t *usec);
+
+#endif // LOGINDEX_H
@@ -0,0 +1,471 @@
+/*
+ * Streaming candump log player for background traffic
+ *
+ * Compressed captures are replayed without decompressing them to disk.  Three
+ * stages run concurrently and hand fixed buffers to each other, so memory stays
+ * bounded however large the log is:
+ *
+ *   read thread    decompresses LOGPLAY_BLOCK bytes at a time
+ *   parse thread   splits the blocks into lines and parses the frames
+ *   caller         sends every frame at its logged time, relative to the start
+ *
+ * Each stage owns LOGPLAY_BUFFERS buffers, so one can be filled while the next
+ * stage drains the other.  Timestamps restart at every pass through the log,
+ * like canplayer -l.
+ *
+ * A start time skips into the first pass.  Plain logs are positioned with the
+ * timestamp index (logindex.h) so nothing before it is read; compressed ones
+ * can not be seeked into and are decompressed and parsed up to that time.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "logplay.h"
+#include "logindex.h"
+#include "lib.h"
+
+// Block and batch states
+#define LOGPLAY_DATA 0
+#define LOGPLAY_END_OF_PASS 1 // Last buffer of a pass through the log
+#define LOGPLAY_DONE 2
+#define LOGPLAY_ERROR 3
+
+#define LOGPLAY_MIN_SLEEP_US 100
+
+typedef struct {
+  int state;
+  size_t len;
+  char data[LOGPLAY_BLOCK];
+} Block;
+
+typedef struct {
+  int state;
+  int count;
+  LogFrame frames[LOGPLAY_BATCH];
+} Batch;
+
+// Blocking handoff of up to LOGPLAY_BUFFERS buffers between two threads
+typedef struct {
+  void *items[LOGPLAY_BUFFERS];
+  int head, count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Queue;
+
+typedef struct {
+  gzFile gz; // gzip, and plain logs read through as is
+#ifdef HAVE_ZSTD
+  FILE *fp;
+  ZSTD_DCtx *zstd;
+  ZSTD_inBuffer in;
+  char *inbuf;
+#endif
+} LogSource;
+
+typedef struct {
+  const char *path;
+  const char *source_if;
+  int loops;
+  uint64_t start_us; // Into the first pass, from its first timestamp
+  int seeked;        // The reader found the start with the index, set before the first block
+  Queue free_blocks, full_blocks;
+  Queue free_batches, full_batches;
+  Block blocks[LOGPLAY_BUFFERS];
+  Batch batches[LOGPLAY_BUFFERS];
+  // Parser state
+  char carry[LOGPLAY_LINE_LEN];
+  size_t carry_len;
+  int skip_line; // The carried line was too long, drop it
+  int pass;
+  uint64_t skip_before; // Frames of the first pass logged earlier are dropped, 0 until known
+  Batch *batch;
+} LogPlayer;
+
+static void queue_init(Queue *q) {
+  memset(q, 0, sizeof(*q));
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->cond, NULL);
+}
+
+static void queue_destroy(Queue *q) {
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->cond);
+}
+
+static void queue_put(Queue *q, void *item) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == LOGPLAY_BUFFERS) pthread_cond_wait(&q->cond, &q->lock);
+  q->items[(q->head + q->count) % LOGPLAY_BUFFERS] = item;
+  q->count++;
+  pthread_cond_broadcast(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static void *queue_get(Queue *q) {
+  void *item;
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0) pthread_cond_wait(&q->cond, &q->lock);
+  item = q->items[q->head];
+  q->head = (q->head + 1) % LOGPLAY_BUFFERS;
+  q->count--;
+  pthread_cond_broadcast(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+  return item;
+}
+
+static int source_open(LogSource *src, const char *path) {
+  unsigned char magic[4] = {0};
+  FILE *fp = fopen(path, "rb");
+
+  memset(src, 0, sizeof(*src));
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  size_t n = fread(magic, 1, sizeof(magic), fp);
+  if (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) {
+#ifdef HAVE_ZSTD
+    rewind(fp);
+    src->fp = fp;
+    src->zstd = ZSTD_createDCtx();
+    src->inbuf = malloc(ZSTD_DStreamInSize());
+    if (!src->zstd || !src->inbuf) {
+      fprintf(stderr, "%s: out of memory\n", path);
+      return -1;
+    }
+    src->in.src = src->inbuf;
+    return 0;
+#else
+    fprintf(stderr, "%s is zstd compressed, rebuild controls with HAVE_ZSTD=1\n", path);
+    fclose(fp);
+    return -1;
+#endif
+  }
+  fclose(fp);
+
+  src->gz = gzopen(path, "rb");
+  if (!src->gz) {
+    perror(path);
+    return -1;
+  }
+  gzbuffer(src->gz, LOGPLAY_BLOCK);
+  return 0;
+}
+
+/* Fills buf with decompressed log, returns 0 at the end and -1 on errors */
+static ssize_t source_read(LogSource *src, char *buf, size_t len) {
+#ifdef HAVE_ZSTD
+  if (src->zstd) {
+    ZSTD_outBuffer out = {buf, len, 0};
+    while (out.pos < out.size) {
+      if (src->in.pos == src->in.size) {
+        src->in.size = fread(src->inbuf, 1, ZSTD_DStreamInSize(), src->fp);
+        src->in.pos = 0;
+        if (src->in.size == 0) break;
+      }
+      size_t ret = ZSTD_decompressStream(src->zstd, &out, &src->in);
+      if (ZSTD_isError(ret)) {
+        fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+        return -1;
+      }
+    }
+    return out.pos;
+  }
+#endif
+  int n = gzread(src->gz, buf, len);
+  if (n < 0) {
+    int err;
+    fprintf(stderr, "gzip: %s\n", gzerror(src->gz, &err));
+  }
+  return n;
+}
+
+static void source_close(LogSource *src) {
+#ifdef HAVE_ZSTD
+  if (src->zstd) {
+    ZSTD_freeDCtx(src->zstd);
+    free(src->inbuf);
+    fclose(src->fp);
+    return;
+  }
+#endif
+  if (src->gz) gzclose(src->gz);
+}
+
+/* Offset of the start time in a plain log, found with the index. -1 on errors */
+static off_t find_start(LogPlayer *lp) {
+  struct stat st;
+  LogIndex idx;
+  off_t pos = -1;
+  int fd = open(lp->path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  const char *log = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (log == MAP_FAILED) return -1;
+  if (logindex_open(lp->path, log, st.st_size, 0, &idx) == 0) {
+    pos = logindex_seek(&idx, log, st.st_size, idx.first_ts_us + lp->start_us);
+    logindex_free(&idx);
+  }
+  munmap((void *)log, st.st_size);
+  return pos;
+}
+
+static void *read_log(void *arg) {
+  LogPlayer *lp = arg;
+  int state = LOGPLAY_DONE;
+  Block *b;
+
+  for (int pass = 0; !lp->loops || pass < lp->loops; pass++) {
+    LogSource src;
+    if (source_open(&src, lp->path) < 0) {
+      state = LOGPLAY_ERROR;
+      break;
+    }
+    if (pass == 0 && lp->start_us && src.gz && gzdirect(src.gz)) {
+      off_t pos = find_start(lp);
+      if (pos >= 0 && gzseek(src.gz, pos, SEEK_SET) == pos) lp->seeked = 1;
+    }
+    for (;;) {
+      b = queue_get(&lp->free_blocks);
+      ssize_t n = source_read(&src, b->data, LOGPLAY_BLOCK);
+      b->len = n > 0 ? (size_t)n : 0;
+      b->state = n > 0 ? LOGPLAY_DATA : LOGPLAY_END_OF_PASS;
+      if (n < 0) state = LOGPLAY_ERROR;
+      if (n <= 0) break;
+      queue_put(&lp->full_blocks, b);
+    }
+    source_close(&src);
+    if (state == LOGPLAY_ERROR) {
+      queue_put(&lp->free_blocks, b);
+      break;
+    }
+    queue_put(&lp->full_blocks, b);
+  }
+
+  b = queue_get(&lp->free_blocks);
+  b->len = 0;
+  b->state = state;
+  queue_put(&lp->full_blocks, b);
+  return NULL;
+}
+
+static void flush_batch(LogPlayer *lp, int state) {
+  lp->batch->state = state;
+  queue_put(&lp->full_batches, lp->batch);
+  lp->batch = queue_get(&lp->free_batches);
+  lp->batch->count = 0;
+}
+
+/* (seconds.micros) interface ID#DATA */
+static void parse_line(LogPlayer *lp, const char *p, const char *end) {
+  char buf[CL_CFSZ];
+  const char *tok;
+  uint64_t ts;
+
+  if (logindex_parse_ts(p, end, &ts) < 0) return;
+  if (lp->pass == 0 && lp->start_us && !lp->seeked) {
+    if (!lp->skip_before) lp->skip_before = ts + lp->start_us;
+    if (ts < lp->skip_before) return;
+  }
+  p = memchr(p, ')', end - p) + 1;
+  while (p < end && *p == ' ') p++;
+  tok = p;
+  while (p < end && *p != ' ') p++;
+  if (lp->source_if &&
+      ((size_t)(p - tok) != strlen(lp->source_if) || memcmp(tok, lp->source_if, p - tok)))
+    return;
+  while (p < end && *p == ' ') p++;
+  tok = p;
+  while (p < end && *p != ' ' && *p != '\r') p++;
+  if (p == tok || p - tok >= (long)sizeof(buf)) return;
+  memcpy(buf, tok, p - tok);
+  buf[p - tok] = '\0';
+
+  LogFrame *f = &lp->batch->frames[lp->batch->count];
+  f->mtu = parse_canframe(buf, &f->frame);
+  if (!f->mtu) return;
+  f->ts_us = ts;
+  if (++lp->batch->count == LOGPLAY_BATCH) flush_batch(lp, LOGPLAY_DATA);
+}
+
+/* Parses the complete lines of a block, the tail is carried into the next one */
+static void parse_block(LogPlayer *lp, const char *p, const char *end) {
+  const char *nl;
+
+  while ((nl = memchr(p, '\n', end - p))) {
+    if (lp->carry_len || lp->skip_line) {
+      size_t n = nl - p;
+      if (!lp->skip_line && lp->carry_len + n <= LOGPLAY_LINE_LEN) {
+        memcpy(lp->carry + lp->carry_len, p, n);
+        parse_line(lp, lp->carry, lp->carry + lp->carry_len + n);
+      }
+      lp->carry_len = 0;
+      lp->skip_line = 0;
+    } else {
+      parse_line(lp, p, nl);
+    }
+    p = nl + 1;
+  }
+  if (p < end) {
+    size_t n = end - p;
+    if (lp->skip_line || lp->carry_len + n > LOGPLAY_LINE_LEN) {
+      lp->skip_line = 1;
+    } else {
+      memcpy(lp->carry + lp->carry_len, p, n);
+      lp->carry_len += n;
+    }
+  }
+}
+
+static void *parse_log(void *arg) {
+  LogPlayer *lp = arg;
+
+  lp->batch = queue_get(&lp->free_batches);
+  lp->batch->count = 0;
+  for (;;) {
+    Block *b = queue_get(&lp->full_blocks);
+    int state = b->state;
+
+    parse_block(lp, b->data, b->data + b->len);
+    queue_put(&lp->free_blocks, b);
+    if (state == LOGPLAY_DATA) continue;
+
+    // A log without a final newline still has a last line
+    if (lp->carry_len && !lp->skip_line) parse_line(lp, lp->carry, lp->carry + lp->carry_len);
+    lp->carry_len = 0;
+    lp->skip_line = 0;
+    if (state != LOGPLAY_END_OF_PASS) {
+      lp->batch->state = state;
+      queue_put(&lp->full_batches, lp->batch);
+      return NULL;
+    }
+    flush_batch(lp, LOGPLAY_END_OF_PASS);
+    lp->pass++;
+  }
+}
+
+static int send_frame(int can_fd, const LogFrame *f, int *fd_warned) {
+  for (int tries = 0; tries < 10; tries++) {
+    if (write(can_fd, &f->frame, f->mtu) == f->mtu) return 0;
+    if (errno == EINVAL && f->mtu == CANFD_MTU) {
+      // Classic interface, skip the FD frames of the log
+      if (!*fd_warned) printf("WARNING: Skipping CAN FD frames, the interface is not FD capable\n");
+      *fd_warned = 1;
+      return 0;
+    }
+    if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+      perror("write");
+      return -1;
+    }
+    // Full TX queue, give the interface a moment
+    struct pollfd pfd = {can_fd, POLLOUT, 0};
+    poll(&pfd, 1, 1);
+  }
+  return 0;
+}
+
+static uint64_t elapsed_us(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000ULL + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+int logplay_run(const char *path, int can_fd, const char *source_if, int loops, uint64_t start_us) {
+  LogPlayer *lp = calloc(1, sizeof(LogPlayer));
+  pthread_t reader, parser;
+  struct timespec base = {0, 0};
+  uint64_t base_ts = 0;
+  int new_pass = 1, fd_warned = 0, ret = 0, state, pass = 0;
+  long pass_frames = 0;
+
+  if (!lp) return -1;
+  lp->path = path;
+  lp->source_if = source_if;
+  lp->loops = loops;
+  lp->start_us = start_us;
+  queue_init(&lp->free_blocks);
+  queue_init(&lp->full_blocks);
+  queue_init(&lp->free_batches);
+  queue_init(&lp->full_batches);
+  for (int i = 0; i < LOGPLAY_BUFFERS; i++) {
+    queue_put(&lp->free_blocks, &lp->blocks[i]);
+    queue_put(&lp->free_batches, &lp->batches[i]);
+  }
+  pthread_create(&reader, NULL, read_log, lp);
+  pthread_create(&parser, NULL, parse_log, lp);
+
+  for (;;) {
+    Batch *batch = queue_get(&lp->full_batches);
+    state = batch->state;
+
+    for (int i = 0; i < batch->count && ret == 0; i++) {
+      const LogFrame *f = &batch->frames[i];
+      if (new_pass) {
+        clock_gettime(CLOCK_MONOTONIC, &base);
+        base_ts = f->ts_us;
+        new_pass = 0;
+      }
+      // Late frames go out at once and the schedule does not drift.  A sleep costs
+      // about the timer slack, frames due sooner than LOGPLAY_MIN_SLEEP_US are sent now.
+      uint64_t offset = f->ts_us > base_ts ? f->ts_us - base_ts : 0;
+      if (offset > elapsed_us(&base) + LOGPLAY_MIN_SLEEP_US) {
+        struct timespec due = {base.tv_sec + offset / 1000000,
+                               base.tv_nsec + (long)(offset % 1000000) * 1000};
+        if (due.tv_nsec >= 1000000000L) {
+          due.tv_sec++;
+          due.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {}
+      }
+      if (send_frame(can_fd, f, &fd_warned) < 0) ret = -1;
+      pass_frames++;
+    }
+    queue_put(&lp->free_batches, batch);
+    if (state == LOGPLAY_END_OF_PASS) {
+      // Looping over a log without frames would spin forever.  A start time past the
+      // last frame only empties the first pass, the next one starts from the beginning.
+      if (pass_frames == 0 && pass == 0 && start_us) {
+        fprintf(stderr, "%s: the start time is past the last frame, looping from the beginning\n",
+                path);
+      } else if (pass_frames == 0) {
+        fprintf(stderr, "%s: no frames to replay\n", path);
+        ret = -1;
+      }
+      new_pass = 1;
+      pass_frames = 0;
+      pass++;
+    }
+    if (state == LOGPLAY_ERROR) ret = -1;
+    if (state == LOGPLAY_DONE || state == LOGPLAY_ERROR || ret < 0) break;
+  }
+
+  // After a write error the other stages are still running, only an exit stops them
+  if (state == LOGPLAY_DONE || state == LOGPLAY_ERROR) {
+    pthread_join(reader, NULL);
+    pthread_join(parser, NULL);
+    queue_destroy(&lp->free_blocks);
+    queue_destroy(&lp->full_blocks);
+    queue_destroy(&lp->free_batches);
+    queue_destroy(&lp->full_batches);
+    free(lp);
+  }
+  return ret;
+}
@@ -0,0 +1,30 @@
+#ifndef LOGPLAY_H
+#define LOGPLAY_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+#define LOGPLAY_BLOCK (256 * 1024) // Decompressed bytes handed to the parser at a time
+#define LOGPLAY_BATCH 1024         // Parsed frames handed to the scheduler at a time
+#define LOGPLAY_BUFFERS 2          // Blocks and batches in flight per stage
+#define LOGPLAY_LINE_LEN 512       // Longest log line carried across blocks
+
+/* === Structures === */
+
+typedef struct {
+  uint64_t ts_us;
+  int mtu;
+  struct canfd_frame frame;
+} LogFrame;
+
+/* === Prototypes === */
+
+// Replays a candump log on can_fd with its original timing, loops times (0 forever).
+// Only frames logged on source_if are sent, NULL sends all of them.  gzip and plain
+// logs are always understood, zstd ones when built with HAVE_ZSTD.  The first pass
+// starts start_us after the first frame of the log, later passes at its beginning.
+int logplay_run(const char *path, int can_fd, const char *source_if, int loops, uint64_t start_us);
+
+#endif // LOGPLAY_H
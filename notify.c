@@ -0,0 +1,44 @@
+/*
+ * Service manager notifications
+ *
+ * Implements the datagram protocol behind sd_notify() so a supervisor
+ * (systemd with Type=notify, or any orchestrator setting NOTIFY_SOCKET) can
+ * tell when icsim is receiving, without linking libsystemd.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "notify.h"
+
+int notify_send(const char *state) {
+  const char *path = getenv("NOTIFY_SOCKET");
+  struct sockaddr_un sa;
+  size_t len;
+  int fd, ret;
+
+  if (!path || (path[0] != '/' && path[0] != '@')) return 0;
+  len = strlen(path);
+  if (len >= sizeof(sa.sun_path)) return -1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  memcpy(sa.sun_path, path, len);
+  if (sa.sun_path[0] == '@') sa.sun_path[0] = '\0'; // Abstract namespace
+
+  fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("notify socket");
+    return -1;
+  }
+  ret = sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&sa,
+               offsetof(struct sockaddr_un, sun_path) + len);
+  if (ret < 0) perror("notify");
+  close(fd);
+  return ret < 0 ? -1 : 0;
+}
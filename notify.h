@@ -0,0 +1,10 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+/* === Prototypes === */
+
+// Sends an sd_notify style state ("READY=1", "STOPPING=1", ...) to
+// $NOTIFY_SOCKET.  Returns 0 when sent or when there is no socket.
+int notify_send(const char *state);
+
+#endif // NOTIFY_H
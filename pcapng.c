@@ -0,0 +1,267 @@
+/*
+ * pcapng capture of the received frames
+ *
+ * Frames are written as LINKTYPE_CAN_SOCKETCAN Enhanced Packet Blocks with
+ * their kernel receive timestamps, so Wireshark decodes the file as is.
+ * The capturing thread only formats each block straight into a pre-faulted,
+ * page aligned buffer.  Filled buffers go to a writer thread that writes
+ * everything queued with one writev(), so a slow disk costs dropped frames
+ * (counted) instead of stalling the receive path.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "pcapng.h"
+
+#define SHB_TYPE 0x0A0D0D0A
+#define IDB_TYPE 0x00000001
+#define EPB_TYPE 0x00000006
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define OPT_END 0
+#define OPT_SHB_USERAPPL 4
+#define OPT_IF_NAME 2
+#define OPT_IF_TSRESOL 9
+
+#ifndef CANFD_FDF
+#define CANFD_FDF 0x04 // Marks CAN FD frames in the LINKTYPE_CAN_SOCKETCAN header
+#endif
+
+#define PAD4(n) (((n) + 3) & ~(size_t)3)
+#define BUF_INDEX(n) ((n) & (PCAPNG_BUFFERS - 1))
+
+static size_t put32(uint8_t *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+  return sizeof(v);
+}
+
+static size_t put_option(uint8_t *p, uint16_t code, const void *data, uint16_t len) {
+  memcpy(p, &code, 2);
+  memcpy(p + 2, &len, 2);
+  memcpy(p + 4, data, len);
+  memset(p + 4 + len, 0, PAD4(len) - len);
+  return 4 + PAD4(len);
+}
+
+/* Section Header Block and Interface Description Block, in host byte order */
+static size_t build_headers(uint8_t *p, const char *ifname) {
+  static const char app[] = "icsim";
+  uint16_t one = 1, zero = 0, linktype = PCAPNG_LINKTYPE_CAN;
+  uint8_t tsresol = 6; // Microseconds, the resolution of SO_TIMESTAMP
+  int64_t section_len = -1;
+  size_t len = 0, start;
+
+  len += put32(p + len, SHB_TYPE);
+  len += 4; // Total length, filled in below
+  len += put32(p + len, BYTE_ORDER_MAGIC);
+  memcpy(p + len, &one, 2);
+  memcpy(p + len + 2, &zero, 2);
+  len += 4;
+  memcpy(p + len, &section_len, 8);
+  len += 8;
+  len += put_option(p + len, OPT_SHB_USERAPPL, app, strlen(app));
+  len += put_option(p + len, OPT_END, NULL, 0);
+  len += 4;
+  put32(p + 4, len);
+  put32(p + len - 4, len);
+
+  start = len;
+  len += put32(p + len, IDB_TYPE);
+  len += 4;
+  memcpy(p + len, &linktype, 2);
+  memcpy(p + len + 2, &zero, 2);
+  len += 4;
+  len += put32(p + len, CANFD_MTU); // Snap length
+  len += put_option(p + len, OPT_IF_NAME, ifname, strlen(ifname));
+  len += put_option(p + len, OPT_IF_TSRESOL, &tsresol, 1);
+  len += put_option(p + len, OPT_END, NULL, 0);
+  len += 4;
+  put32(p + start + 4, len - start);
+  put32(p + len - 4, len - start);
+  return len;
+}
+
+/* Writes every iovec, retrying short writes. The first error is kept and reported */
+static void write_all(PcapWriter *pw, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t w = writev(pw->fd, iov, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      if (!pw->error) {
+        pw->error = errno;
+        printf("WARNING: Could not write the capture %s: %s\n", pw->path, strerror(errno));
+      }
+      return;
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
+static void *writer_thread(void *arg) {
+  PcapWriter *pw = arg;
+  struct iovec iov[PCAPNG_BUFFERS];
+  uint64_t done = 0;
+
+  pthread_mutex_lock(&pw->lock);
+  for (;;) {
+    while (pw->filling == done && !pw->stopping) pthread_cond_wait(&pw->wake, &pw->lock);
+    uint64_t end = pw->filling;
+    if (end == done) break; // Stopping and nothing left
+    pthread_mutex_unlock(&pw->lock);
+
+    int n = 0;
+    for (uint64_t i = done; i < end; i++) {
+      iov[n].iov_base = pw->bufs[BUF_INDEX(i)];
+      iov[n].iov_len = pw->lens[BUF_INDEX(i)];
+      n++;
+    }
+    write_all(pw, iov, n);
+    for (uint64_t i = done; i < end; i++) pw->lens[BUF_INDEX(i)] = 0;
+    done = end;
+    // Gives the buffers back to the producer
+    atomic_store_explicit(&pw->written, done, memory_order_release);
+
+    pthread_mutex_lock(&pw->lock);
+  }
+  pthread_mutex_unlock(&pw->lock);
+  return NULL;
+}
+
+static void free_buffers(PcapWriter *pw) {
+  for (int i = 0; i < PCAPNG_BUFFERS; i++) free(pw->bufs[i]);
+}
+
+int pcapng_open(PcapWriter *pw, const char *path, const char *ifname) {
+  uint8_t header[256];
+  size_t len;
+
+  memset(pw, 0, sizeof(*pw));
+  pw->path = path;
+  for (int i = 0; i < PCAPNG_BUFFERS; i++) {
+    if (posix_memalign((void **)&pw->bufs[i], 4096, PCAPNG_BLOCK_SIZE) != 0) {
+      free_buffers(pw);
+      return -1;
+    }
+    // Touch every page now so capturing never takes a page fault
+    memset(pw->bufs[i], 0, PCAPNG_BLOCK_SIZE);
+  }
+
+  pw->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (pw->fd < 0) {
+    perror(path);
+    free_buffers(pw);
+    return -1;
+  }
+  len = build_headers(header, ifname);
+  if (write(pw->fd, header, len) != (ssize_t)len) {
+    perror(path);
+    close(pw->fd);
+    free_buffers(pw);
+    return -1;
+  }
+
+  atomic_init(&pw->written, 0);
+  pthread_mutex_init(&pw->lock, NULL);
+  pthread_cond_init(&pw->wake, NULL);
+  if (pthread_create(&pw->writer, NULL, writer_thread, pw) != 0) {
+    printf("ERROR: Could not start the capture writer\n");
+    close(pw->fd);
+    free_buffers(pw);
+    return -1;
+  }
+  return 0;
+}
+
+/* The buffer being filled belongs to the producer until the writer falls a whole ring behind */
+static int has_buffer(PcapWriter *pw) {
+  return pw->filling - atomic_load_explicit(&pw->written, memory_order_acquire) < PCAPNG_BUFFERS;
+}
+
+static void submit(PcapWriter *pw) {
+  pthread_mutex_lock(&pw->lock);
+  pw->filling++;
+  pthread_cond_signal(&pw->wake);
+  pthread_mutex_unlock(&pw->lock);
+}
+
+static long age_ms(const struct timeval *from, const struct timeval *to) {
+  return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_usec - from->tv_usec) / 1000;
+}
+
+void pcapng_record(PcapWriter *pw, const struct canfd_frame *cf, int mtu, const struct timeval *ts) {
+  int fd = (mtu == CANFD_MTU);
+  uint8_t max = fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  uint8_t len = cf->len > max ? max : cf->len;
+  size_t caplen = CAN_MTU - CAN_MAX_DLEN + len;
+  size_t total = 28 + PAD4(caplen) + 4;
+  uint64_t ts_us = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+
+  if (!has_buffer(pw)) {
+    pw->dropped++;
+    return;
+  }
+  size_t used = pw->lens[BUF_INDEX(pw->filling)];
+  if (used && (used + total > PCAPNG_BLOCK_SIZE || age_ms(&pw->first_ts, ts) >= PCAPNG_FLUSH_MS)) {
+    submit(pw);
+    if (!has_buffer(pw)) {
+      pw->dropped++;
+      return;
+    }
+    used = 0;
+  }
+  if (!used) pw->first_ts = *ts;
+
+  uint8_t *p = pw->bufs[BUF_INDEX(pw->filling)] + used;
+  put32(p, EPB_TYPE);
+  put32(p + 4, total);
+  put32(p + 8, 0); // Interface
+  put32(p + 12, ts_us >> 32);
+  put32(p + 16, (uint32_t)ts_us);
+  put32(p + 20, caplen);
+  put32(p + 24, caplen);
+  // SocketCAN header with the ID in network byte order, then the payload
+  put32(p + 28, htonl(cf->can_id));
+  p[32] = len;
+  p[33] = fd ? (cf->flags | CANFD_FDF) : 0;
+  p[34] = 0;
+  p[35] = 0;
+  memcpy(p + 36, cf->data, len);
+  memset(p + 36 + len, 0, PAD4(caplen) - caplen);
+  put32(p + total - 4, total);
+
+  pw->lens[BUF_INDEX(pw->filling)] = used + total;
+  pw->frames++;
+}
+
+void pcapng_flush(PcapWriter *pw) {
+  if (has_buffer(pw) && pw->lens[BUF_INDEX(pw->filling)]) submit(pw);
+}
+
+int pcapng_close(PcapWriter *pw) {
+  pcapng_flush(pw);
+  pthread_mutex_lock(&pw->lock);
+  pw->stopping = 1;
+  pthread_cond_signal(&pw->wake);
+  pthread_mutex_unlock(&pw->lock);
+  pthread_join(pw->writer, NULL);
+
+  if (close(pw->fd) < 0 && !pw->error) pw->error = errno;
+  pthread_mutex_destroy(&pw->lock);
+  pthread_cond_destroy(&pw->wake);
+  free_buffers(pw);
+  return pw->error ? -1 : 0;
+}
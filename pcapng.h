@@ -0,0 +1,50 @@
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+#include <linux/can.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* === Constants === */
+
+#define PCAPNG_LINKTYPE_CAN 227     // LINKTYPE_CAN_SOCKETCAN
+#define PCAPNG_BLOCK_SIZE (1 << 20) // Bytes per write buffer, page aligned
+#define PCAPNG_BUFFERS 8            // Power of two, about 2 s of a saturated bus each
+#define PCAPNG_FLUSH_MS 1000        // Oldest frame a partly filled buffer may hold
+
+/* === Structures === */
+
+// pcapng capture file.  One thread appends frames to the current buffer, a
+// writer thread flushes the filled buffers in order with a single writev().
+// Buffers are indexed by a running count so the two sides only share counters.
+typedef struct {
+  int fd;
+  const char *path;
+  uint8_t *bufs[PCAPNG_BUFFERS];
+  size_t lens[PCAPNG_BUFFERS];
+  uint64_t filling;         // Buffer being appended to, the earlier ones wait for the writer
+  struct timeval first_ts;  // Timestamp of its first frame
+  _Atomic uint64_t written; // Buffers the writer has finished with
+  uint64_t frames;          // Frames captured, producer only
+  uint64_t dropped;         // Frames lost while every buffer waited for the disk
+  int error;                // errno of the first failed write, writer only
+  int stopping;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} PcapWriter;
+
+/* === Prototypes === */
+
+// Creates path and writes the section and interface headers. Returns 0 on success
+int pcapng_open(PcapWriter *pw, const char *path, const char *ifname);
+// Appends a received frame, never blocks. Frames are dropped when the disk falls behind
+void pcapng_record(PcapWriter *pw, const struct canfd_frame *cf, int mtu, const struct timeval *ts);
+// Hands a partly filled buffer to the writer, for when the bus goes quiet
+void pcapng_flush(PcapWriter *pw);
+// Writes out what is left and closes the file. Returns -1 if any write failed
+int pcapng_close(PcapWriter *pw);
+
+#endif // PCAPNG_H
@@ -0,0 +1,80 @@
+/*
+ * Receive ring between the socket thread and the decoder
+ *
+ * The RX thread only copies frames and their kernel timestamps into the ring,
+ * so a slow decode (or a lock held by the renderer) never delays recvmsg().
+ * The consumer sleeps on a futex when the ring is empty; the producer only
+ * makes the wake syscall when the consumer has said it is about to sleep.
+ */
+
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rxring.h"
+
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+int rxring_init(RxRing *r) {
+  memset(r, 0, sizeof(*r));
+  r->slots = calloc(RXRING_SLOTS, sizeof(FlightRecord));
+  if (!r->slots) return -1;
+  r->mask = RXRING_SLOTS - 1;
+  return 0;
+}
+
+void rxring_free(RxRing *r) {
+  free(r->slots);
+  r->slots = NULL;
+}
+
+int rxring_push(RxRing *r, const struct canfd_frame *cf, int mtu, const struct timeval *ts) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) > r->mask) {
+    r->dropped++;
+    return -1;
+  }
+  FlightRecord *slot = &r->slots[head & r->mask];
+  slot->ts = *ts;
+  slot->mtu = mtu;
+  memcpy(&slot->frame, cf, mtu);
+
+  // Pairs with the store of waiting in rxring_pop(): either the consumer
+  // sees the new head or we see that it went to sleep
+  atomic_store(&r->head, head + 1);
+  if (atomic_load(&r->waiting)) {
+    atomic_store(&r->waiting, 0);
+    futex(&r->waiting, FUTEX_WAKE_PRIVATE, 1, NULL);
+  }
+  return 0;
+}
+
+int rxring_pop(RxRing *r, FlightRecord *out) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (atomic_load_explicit(&r->head, memory_order_acquire) == tail) {
+    struct timespec ts = {0, RXRING_WAIT_MS * 1000000L};
+    atomic_store(&r->waiting, 1);
+    if (atomic_load(&r->head) == tail) futex(&r->waiting, FUTEX_WAIT_PRIVATE, 1, &ts);
+    atomic_store(&r->waiting, 0);
+    if (atomic_load_explicit(&r->head, memory_order_acquire) == tail) return 0;
+  }
+
+  const FlightRecord *slot = &r->slots[tail & r->mask];
+  out->ts = slot->ts;
+  out->mtu = slot->mtu;
+  memcpy(&out->frame, &slot->frame, slot->mtu);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+void rxring_wake(RxRing *r) {
+  atomic_store(&r->waiting, 0);
+  futex(&r->waiting, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
@@ -0,0 +1,38 @@
+#ifndef RXRING_H
+#define RXRING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "flightrec.h"
+
+/* === Constants === */
+
+#define RXRING_SLOTS 4096    // Power of two, about 0.4 s of a saturated 1 Mbit/s bus
+#define RXRING_WAIT_MS 100   // Longest the consumer sleeps before rechecking for shutdown
+
+/* === Structures === */
+
+// Lock-free single producer / single consumer ring of received frames.
+// The producer and consumer indices live on separate cache lines.
+typedef struct {
+  FlightRecord *slots;
+  uint64_t mask;
+  _Alignas(64) _Atomic uint64_t head; // Written by the producer
+  uint64_t dropped;                   // Frames lost to a full ring, producer only
+  _Alignas(64) _Atomic uint64_t tail; // Written by the consumer
+  _Atomic uint32_t waiting;           // Futex word, 1 while the consumer sleeps
+} RxRing;
+
+/* === Prototypes === */
+
+int rxring_init(RxRing *r);
+void rxring_free(RxRing *r);
+// Producer: returns -1 and counts a drop when the ring is full
+int rxring_push(RxRing *r, const struct canfd_frame *cf, int mtu, const struct timeval *ts);
+// Consumer: returns 1 with a record, 0 when nothing arrived within RXRING_WAIT_MS
+int rxring_pop(RxRing *r, FlightRecord *out);
+// Makes a sleeping consumer return from rxring_pop() right away
+void rxring_wake(RxRing *r);
+
+#endif // RXRING_H
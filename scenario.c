@@ -0,0 +1,325 @@
+/*
+ * Scenario scripts for driving controls without an input device
+ *
+ * A scenario is a text file with one instruction per line:
+ *
+ *   seed 42                # Seed for the random values below (default 1)
+ *   repeat 100             # Block repeated N times, 'repeat' alone loops forever
+ *     throttle 1           # 1 accelerate, 0 coast, -1 brake
+ *     wait 2000..4000      # Milliseconds, A..B picks a random value in the range
+ *     throttle -1
+ *     turn left            # left, right or off
+ *     lock all             # all, or door numbers: lock 1 3
+ *     unlock 2
+ *     handbrake on
+ *     frame 19B#00000FXX   # Raw frame in candump format, XX bytes are random
+ *   end
+ *
+ * Every numeric value accepts a range.  Random values come from the
+ * scenario's own generator, so a scenario produces the same sequence of
+ * actions and waits on every run.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scenario.h"
+#include "lib.h"
+
+#define SCENARIO_LINE_LEN 256
+
+static int parse_range(const char *tok, int *lo, int *hi) {
+  char *end;
+  long a = strtol(tok, &end, 10), b = a;
+
+  if (end == tok) return -1;
+  if (!strncmp(end, "..", 2)) {
+    const char *p = end + 2;
+    b = strtol(p, &end, 10);
+    if (end == p) return -1;
+  }
+  if (*end || b < a) return -1;
+  *lo = a;
+  *hi = b;
+  return 0;
+}
+
+/* lock / unlock arguments: 'all' or a list of door numbers */
+static int parse_doors(char **toks, int n, int *mask) {
+  *mask = 0;
+  if (n == 0) {
+    *mask = SCENARIO_DOOR_ALL;
+    return 0;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!strcmp(toks[i], "all")) {
+      *mask |= SCENARIO_DOOR_ALL;
+    } else if (toks[i][0] >= '1' && toks[i][0] <= '4' && !toks[i][1]) {
+      *mask |= 1 << (toks[i][0] - '1');
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* candump style frame, XX marks a byte randomized on every send */
+static int parse_frame(char *tok, ScenarioOp *op) {
+  char *p = strchr(tok, '#');
+  int byte = 0;
+
+  if (!p) return -1;
+  p++;
+  if (*p == '#') p += 2; // CAN FD flags nibble
+  for (; p[0] && p[1]; p += 2) {
+    if (*p == '.') p++;
+    if (!p[0] || !p[1]) break;
+    if (toupper((unsigned char)p[0]) == 'X' && toupper((unsigned char)p[1]) == 'X') {
+      if (byte < 64) op->random_mask |= 1ULL << byte;
+      p[0] = p[1] = '0';
+    }
+    byte++;
+  }
+  op->mtu = parse_canframe(tok, &op->frame);
+  return op->mtu ? 0 : -1;
+}
+
+static int parse_line(Scenario *sc, char **toks, int n, ScenarioOp *op) {
+  const char *cmd = toks[0];
+  int argc = n - 1;
+
+  op->lo = op->hi = 0;
+  if (!strcmp(cmd, "throttle") && argc == 1) {
+    op->op = SCEN_THROTTLE;
+    return parse_range(toks[1], &op->lo, &op->hi) < 0 || op->lo < -1 || op->hi > 1 ? -1 : 0;
+  }
+  if (!strcmp(cmd, "turn") && argc == 1) {
+    op->op = SCEN_TURN;
+    if (!strcmp(toks[1], "left")) {
+      op->lo = op->hi = -1;
+    } else if (!strcmp(toks[1], "right")) {
+      op->lo = op->hi = 1;
+    } else if (strcmp(toks[1], "off")) {
+      return -1;
+    }
+    return 0;
+  }
+  if (!strcmp(cmd, "lock") || !strcmp(cmd, "unlock")) {
+    op->op = !strcmp(cmd, "lock") ? SCEN_LOCK : SCEN_UNLOCK;
+    if (parse_doors(toks + 1, argc, &op->lo) < 0) return -1;
+    op->hi = op->lo;
+    return 0;
+  }
+  if (!strcmp(cmd, "handbrake") && argc == 1) {
+    op->op = SCEN_HANDBRAKE;
+    if (!strcmp(toks[1], "on")) {
+      op->lo = op->hi = 1;
+    } else if (strcmp(toks[1], "off")) {
+      return -1;
+    }
+    return 0;
+  }
+  if (!strcmp(cmd, "wait") && argc == 1) {
+    op->op = SCEN_WAIT;
+    return parse_range(toks[1], &op->lo, &op->hi) < 0 || op->lo < 0 ? -1 : 0;
+  }
+  if (!strcmp(cmd, "frame") && argc == 1) {
+    op->op = SCEN_FRAME;
+    return parse_frame(toks[1], op);
+  }
+  if (!strcmp(cmd, "repeat") && argc <= 1) {
+    op->op = SCEN_REPEAT;
+    if (argc == 0 || !strcmp(toks[1], "forever")) return 0;
+    return parse_range(toks[1], &op->lo, &op->hi) < 0 || op->lo < 1 ? -1 : 0;
+  }
+  if (!strcmp(cmd, "end") && argc == 0) {
+    op->op = SCEN_END;
+    return 0;
+  }
+  if (!strcmp(cmd, "seed") && argc == 1) {
+    sc->seed = strtoul(toks[1], NULL, 0);
+    op->op = -1; // Not an instruction
+    return 0;
+  }
+  return -1;
+}
+
+int scenario_load(const char *path, Scenario *sc) {
+  FILE *fp = fopen(path, "r");
+  char line[SCENARIO_LINE_LEN];
+  int cap = 0, lineno = 0, depth = 0;
+  int open_repeat[SCENARIO_MAX_DEPTH];
+
+  memset(sc, 0, sizeof(*sc));
+  sc->seed = 1;
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    char *toks[16], *save, *t;
+    int n = 0;
+    ScenarioOp op;
+
+    lineno++;
+    // Comments start with a # at the beginning of a word, frames use # inside one
+    for (t = strchr(line, '#'); t; t = strchr(t + 1, '#')) {
+      if (t == line || isspace((unsigned char)t[-1])) {
+        *t = '\0';
+        break;
+      }
+    }
+    for (t = strtok_r(line, " \t\r\n", &save); t && n < 16; t = strtok_r(NULL, " \t\r\n", &save))
+      toks[n++] = t;
+    if (n == 0) continue;
+
+    memset(&op, 0, sizeof(op));
+    op.line = lineno;
+    if (parse_line(sc, toks, n, &op) < 0) {
+      fprintf(stderr, "[SCENARIO] %s:%d: invalid instruction '%s'\n", path, lineno, toks[0]);
+      goto fail;
+    }
+    if (op.op < 0) continue;
+
+    if (op.op == SCEN_REPEAT) {
+      if (depth == SCENARIO_MAX_DEPTH) {
+        fprintf(stderr, "[SCENARIO] %s:%d: repeat nested too deep\n", path, lineno);
+        goto fail;
+      }
+      open_repeat[depth++] = sc->nops;
+    } else if (op.op == SCEN_END) {
+      if (depth == 0) {
+        fprintf(stderr, "[SCENARIO] %s:%d: end without repeat\n", path, lineno);
+        goto fail;
+      }
+      op.match = open_repeat[--depth];
+      if (op.match == sc->nops - 1) {
+        fprintf(stderr, "[SCENARIO] %s:%d: empty repeat block\n", path, lineno);
+        goto fail;
+      }
+      sc->ops[op.match].match = sc->nops;
+    }
+
+    if (sc->nops == cap) {
+      int ncap = cap ? cap * 2 : 32;
+      ScenarioOp *ops = realloc(sc->ops, ncap * sizeof(ScenarioOp));
+      if (!ops) goto fail;
+      sc->ops = ops;
+      cap = ncap;
+    }
+    sc->ops[sc->nops++] = op;
+  }
+  if (depth) {
+    fprintf(stderr, "[SCENARIO] %s: repeat on line %d has no end\n", path,
+            sc->ops[open_repeat[depth - 1]].line);
+    goto fail;
+  }
+  fclose(fp);
+  return 0;
+
+fail:
+  fclose(fp);
+  scenario_free(sc);
+  return -1;
+}
+
+void scenario_free(Scenario *sc) {
+  free(sc->ops);
+  sc->ops = NULL;
+  sc->nops = 0;
+}
+
+/* xorshift64*, independent of rand() so the scenario does not depend on controls */
+static uint32_t next_random(Scenario *sc) {
+  sc->rng ^= sc->rng >> 12;
+  sc->rng ^= sc->rng << 25;
+  sc->rng ^= sc->rng >> 27;
+  return (sc->rng * 2685821657736338717ULL) >> 32;
+}
+
+static int pick(Scenario *sc, const ScenarioOp *op) {
+  if (op->lo == op->hi) return op->lo;
+  return op->lo + (int)(next_random(sc) % (uint32_t)(op->hi - op->lo + 1));
+}
+
+static void make_action(Scenario *sc, const ScenarioOp *op, ScenarioAction *out) {
+  out->op = op->op;
+  if (op->op == SCEN_FRAME) {
+    out->mtu = op->mtu;
+    out->frame = op->frame;
+    for (int i = 0; i < CANFD_MAX_DLEN; i++)
+      if (op->random_mask & (1ULL << i)) out->frame.data[i] = next_random(sc) & 0xff;
+  } else {
+    out->value = pick(sc, op);
+  }
+}
+
+void scenario_start(Scenario *sc, uint32_t now) {
+  sc->pc = 0;
+  sc->depth = 0;
+  sc->deadline = now;
+  sc->rng = ((uint64_t)sc->seed << 1) | 1;
+}
+
+uint32_t scenario_deadline(const Scenario *sc) {
+  return sc->deadline;
+}
+
+int scenario_uses_fd(const Scenario *sc) {
+  for (int i = 0; i < sc->nops; i++)
+    if (sc->ops[i].op == SCEN_FRAME && sc->ops[i].mtu == CANFD_MTU) return 1;
+  return 0;
+}
+
+int scenario_next(Scenario *sc, uint32_t now, ScenarioAction *out) {
+  for (;;) {
+    if ((int32_t)(now - sc->deadline) < 0) return SCEN_PENDING;
+    if (sc->pc >= sc->nops) return SCEN_DONE;
+
+    const ScenarioOp *op = &sc->ops[sc->pc++];
+    switch (op->op) {
+    case SCEN_WAIT:
+      // Waits add up from the previous deadline so the timeline does not drift
+      sc->deadline += pick(sc, op);
+      break;
+    case SCEN_REPEAT:
+      sc->loop_pc[sc->depth] = sc->pc;
+      sc->loop_left[sc->depth] = (op->hi == 0) ? -1 : pick(sc, op);
+      sc->depth++;
+      break;
+    case SCEN_END: {
+      long *left = &sc->loop_left[sc->depth - 1];
+      if (*left > 0) (*left)--;
+      if (*left) {
+        sc->pc = sc->loop_pc[sc->depth - 1];
+      } else {
+        sc->depth--;
+      }
+      break;
+    }
+    default:
+      make_action(sc, op, out);
+      return SCEN_ACTION;
+    }
+  }
+}
+
+int scenario_parse_action(Scenario *sc, char *line, ScenarioAction *out) {
+  char *toks[16], *save, *t;
+  int n = 0;
+  ScenarioOp op;
+
+  for (t = strtok_r(line, " \t\r\n", &save); t && n < 16; t = strtok_r(NULL, " \t\r\n", &save))
+    toks[n++] = t;
+  if (n == 0) return -1;
+
+  memset(&op, 0, sizeof(op));
+  if (parse_line(sc, toks, n, &op) < 0) return -1;
+  // Only instructions that do something on their own make sense outside a script
+  if (op.op < 0 || op.op == SCEN_WAIT || op.op == SCEN_REPEAT || op.op == SCEN_END) return -1;
+  make_action(sc, &op, out);
+  return 0;
+}
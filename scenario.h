@@ -0,0 +1,73 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* === Constants === */
+
+// Instructions
+#define SCEN_THROTTLE 0  // value: -1 brake, 0 coast, 1 accelerate
+#define SCEN_TURN 1      // value: -1 left, 0 off, 1 right
+#define SCEN_LOCK 2      // value: door mask (CAN_DOORn_LOCK bits)
+#define SCEN_UNLOCK 3
+#define SCEN_HANDBRAKE 4 // value: 0 / 1
+#define SCEN_WAIT 5      // value: milliseconds
+#define SCEN_FRAME 6     // frame, bytes in random_mask are randomized
+#define SCEN_REPEAT 7    // value: count, 0 repeats forever
+#define SCEN_END 8
+
+// scenario_next() results
+#define SCEN_ACTION 0 // out holds an action to perform
+#define SCEN_PENDING 1 // Nothing due before scenario_deadline()
+#define SCEN_DONE 2
+
+#define SCENARIO_MAX_DEPTH 8 // Nested repeat blocks
+#define SCENARIO_DOOR_ALL 0xf
+
+/* === Structures === */
+
+typedef struct {
+  int op;                   // SCEN_*
+  int lo, hi;               // Value, or random range lo..hi
+  int match;                // REPEAT: index of its END, END: index of its REPEAT
+  int line;                 // Line in the scenario file, for error messages
+  int mtu;                  // FRAME
+  uint64_t random_mask;     // FRAME: bytes written as XX in the file
+  struct canfd_frame frame; // FRAME
+} ScenarioOp;
+
+// An action handed to the caller by scenario_next()
+typedef struct {
+  int op;
+  int value;
+  int mtu;
+  struct canfd_frame frame;
+} ScenarioAction;
+
+typedef struct {
+  ScenarioOp *ops;
+  int nops;
+  uint32_t seed;
+  // Runtime
+  int pc;
+  int depth;
+  int loop_pc[SCENARIO_MAX_DEPTH];
+  long loop_left[SCENARIO_MAX_DEPTH]; // -1 forever
+  uint32_t deadline;                  // Time the current wait ends
+  uint64_t rng;
+} Scenario;
+
+/* === Prototypes === */
+
+int scenario_load(const char *path, Scenario *sc);
+void scenario_free(Scenario *sc);
+// Restarts from the top with the scenario's seed, waits count from now
+void scenario_start(Scenario *sc, uint32_t now);
+int scenario_next(Scenario *sc, uint32_t now, ScenarioAction *out);
+uint32_t scenario_deadline(const Scenario *sc);
+int scenario_uses_fd(const Scenario *sc);
+// Parses a single action instruction (no wait or repeat), ranges use sc's generator
+int scenario_parse_action(Scenario *sc, char *line, ScenarioAction *out);
+
+#endif // SCENARIO_H
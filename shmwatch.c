@@ -0,0 +1,45 @@
+/*
+ * shmwatch - prints the cluster state exported by icsim -E
+ *
+ * Example reader for icsim_shm.h.  Sleeps until icsim publishes a change,
+ * so it costs nothing while the display is static.
+ *
+ * Usage: shmwatch [segment name]
+ */
+
+#include <stdio.h>
+
+#include "icsim_shm.h"
+
+int main(int argc, char *argv[]) {
+  const char *name = (argc > 1) ? argv[1] : ICSIM_SHM_DEFAULT_NAME;
+  IcsimShm *shm = icsim_shm_open(name);
+  IcsimShmState st;
+
+  if (!shm) {
+    fprintf(stderr, "Could not open %s, is icsim running with -E?\n", name);
+    return 1;
+  }
+
+  uint32_t gen = icsim_shm_read(shm, &st);
+  for (;;) {
+    printf("[%u] speed %ld rpm %ld doors %d%d%d%d turn %d%d handbrake %d lock %d security %d", gen,
+           (long)st.speed, (long)st.rpm, st.door_status[0], st.door_status[1], st.door_status[2],
+           st.door_status[3], st.turn_status[0], st.turn_status[1], st.handbrake, st.lock_status,
+           st.security_state);
+    if (st.err_frames) {
+      printf(" errors %lu (bus-off %lu passive %lu protocol %lu rx-overflow %lu)",
+             (unsigned long)st.err_frames, (unsigned long)st.err_bus_off,
+             (unsigned long)st.err_passive, (unsigned long)st.err_protocol,
+             (unsigned long)st.err_rx_overflow);
+    }
+    if (st.err_fd_esi) printf(" esi %lu", (unsigned long)st.err_fd_esi);
+    printf("\n");
+    fflush(stdout);
+    if (icsim_shm_wait(shm, gen, -1) < 0) break;
+    gen = icsim_shm_read(shm, &st);
+  }
+
+  icsim_shm_close(shm);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * png2c - converts an image into a pre-decoded pixel array for icsim
+ *
+ * Usage: png2c <image.png> <name> [x y w h] > name.c
+ *
+ * The output defines `const Asset asset_<name>` (see assets.h) holding the
+ * image, or only the x, y, w, h part of it, as ARGB8888 pixels, ready for
+ * SDL_UpdateTexture().
+ */
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 7) {
+    fprintf(stderr, "Usage: png2c <image.png> <name> [x y w h]\n");
+    return 1;
+  }
+
+  SDL_Surface *image = IMG_Load(argv[1]);
+  if (!image) {
+    fprintf(stderr, "png2c: %s: %s\n", argv[1], SDL_GetError());
+    return 1;
+  }
+  SDL_Surface *argb = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(image);
+  if (!argb) {
+    fprintf(stderr, "png2c: %s: %s\n", argv[1], SDL_GetError());
+    return 1;
+  }
+  SDL_Rect area = {0, 0, argb->w, argb->h};
+  if (argc == 7) {
+    area.x = atoi(argv[3]);
+    area.y = atoi(argv[4]);
+    area.w = atoi(argv[5]);
+    area.h = atoi(argv[6]);
+  }
+  if (area.x < 0 || area.y < 0 || area.w < 1 || area.h < 1 || area.x + area.w > argb->w ||
+      area.y + area.h > argb->h) {
+    fprintf(stderr, "png2c: %s: area is outside the %dx%d image\n", argv[1], argb->w, argb->h);
+    return 1;
+  }
+
+  printf("/* Generated by png2c from %s, do not edit */\n\n", argv[1]);
+  printf("#include \"assets.h\"\n\n");
+  printf("static const Uint32 %s_pixels[%d] = {", argv[2], area.w * area.h);
+  for (int y = area.y; y < area.y + area.h; y++) {
+    const Uint32 *row = (const Uint32 *)((const Uint8 *)argb->pixels + y * argb->pitch);
+    printf("\n");
+    for (int x = area.x; x < area.x + area.w; x++) {
+      // Transparent pixels are most of the sprites, keep them short
+      if (row[x] == 0) {
+        printf("0,");
+      } else {
+        printf("0x%08x,", row[x]);
+      }
+    }
+  }
+  printf("\n};\n\n");
+  printf("const Asset asset_%s = {%d, %d, %s_pixels};\n", argv[2], area.w, area.h, argv[2]);
+
+  SDL_FreeSurface(argb);
+  return 0;
+}
@@ -0,0 +1,11 @@
+/*
+ * UDS SecurityAccess key algorithm
+ */
+
+#include "uds.h"
+
+void calculate_key(uint8_t seed, uint8_t *key_out) {
+  key_out[0] = seed ^ 0xAA;
+  key_out[1] = (seed + 1) ^ 0xAA;
+  key_out[2] = (seed + 2) ^ 0xAA;
+}
@@ -0,0 +1,46 @@
+#ifndef UDS_H
+#define UDS_H
+
+/*
+ * UDS SecurityAccess as implemented by icsim, shared with the udsbench client.
+ *
+ * Testers address the cluster either functionally on UDS_DIAG_ID or
+ * physically on UDS_PHYS_REQ_ID + n.  Every physical address is a separate
+ * tester with its own SecurityAccess session; the functional address shares
+ * tester 0's.  Responses come from UDS_RESP_ID + n.
+ */
+
+#include <stdint.h>
+
+/* === Constants === */
+
+#define UDS_SECURITY_REQ          0x27
+#define UDS_SECURITY_REQ_SEED     0x01
+#define UDS_SECURITY_REQ_KEY      0x02
+#define UDS_POSITIVE_RESPONSE     0x40 // Added to the SID
+#define UDS_NEGATIVE_RESPONSE     0x7F
+#define UDS_NRC_SEQUENCE_ERROR    0x24 // requestSequenceError
+#define UDS_NRC_INVALID_KEY       0x35
+#define UDS_NRC_EXCEEDED_ATTEMPTS 0x36
+#define UDS_NRC_DELAY_NOT_EXPIRED 0x37 // requiredTimeDelayNotExpired
+
+#define UDS_DIAG_ID               0x7DF // Functional requests
+#define UDS_PHYS_REQ_ID           0x7E0 // Physical requests of tester 0
+#define UDS_RESP_ID               0x7E8 // Responses to tester 0
+#define UDS_TESTERS               8
+
+#define UDS_KEY_LEN               3
+
+/* === Prototypes === */
+
+// Tester behind a request ID, -1 for IDs that are not UDS requests
+static inline int uds_tester(uint32_t can_id) {
+  if (can_id == UDS_DIAG_ID) return 0;
+  if (can_id >= UDS_PHYS_REQ_ID && can_id < UDS_PHYS_REQ_ID + UDS_TESTERS)
+    return can_id - UDS_PHYS_REQ_ID;
+  return -1;
+}
+
+void calculate_key(uint8_t seed, uint8_t *key_out);
+
+#endif // UDS_H
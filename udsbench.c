@@ -0,0 +1,300 @@
+/*
+ * udsbench - SecurityAccess load generator and latency benchmark
+ *
+ * Runs seed/key exchanges against icsim as fast as it answers, with one
+ * exchange in flight per tester address (-c), and reports the seed and key
+ * response latencies, the negative responses by NRC and the timeouts.
+ *
+ *   udsbench -n 100000 vcan0          # correct keys, 8 testers in parallel
+ *   udsbench -k wrong -c 1 vcan0      # NRC load on a single tester
+ *   udsbench -k sweep -n 4096 vcan0   # brute force the key, reports each hit
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "latency.h"
+#include "uds.h"
+
+#define DEFAULT_COUNT 1000
+#define DEFAULT_TIMEOUT_MS 100
+#define RX_BATCH 64
+
+// Key modes
+#define KEY_VALID 0
+#define KEY_WRONG 1
+#define KEY_SWEEP 2 // 24-bit counter, one candidate per exchange
+
+// Tester states
+#define IDLE 0
+#define WAIT_SEED 1
+#define WAIT_KEY 2
+
+typedef struct {
+  int state;
+  uint32_t sent_us; // Time of the outstanding request
+  uint32_t key;     // Candidate sent in sweep mode
+} Tester;
+
+typedef struct {
+  long started;
+  long completed;
+  long unlocked;
+  long timeouts;
+  long unexpected; // Responses nobody was waiting for, mostly late ones
+  long nrc[256];
+  LatencyHist seed_latency;
+  LatencyHist key_latency;
+} Stats;
+
+static int sock;
+static int key_mode = KEY_VALID;
+static uint32_t next_candidate;
+static int verbose;
+
+static void usage(const char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "Usage: udsbench [options] <can>\n");
+  fprintf(stderr, "\t-n\tnumber of seed/key exchanges (default: %d)\n", DEFAULT_COUNT);
+  fprintf(stderr, "\t-c\ttesters in parallel, 1-%d (default: %d)\n", UDS_TESTERS, UDS_TESTERS);
+  fprintf(stderr, "\t-t\tresponse timeout in ms (default: %d)\n", DEFAULT_TIMEOUT_MS);
+  fprintf(stderr, "\t-k\tkeys to send: valid, wrong or sweep (default: valid)\n");
+  fprintf(stderr, "\t-s\tfirst key of the sweep, as hex (default: 0)\n");
+  fprintf(stderr, "\t-H\tprint the latency histograms\n");
+  fprintf(stderr, "\t-v\tprint every response\n");
+  exit(2);
+}
+
+static int open_socket(const char *ifname) {
+  struct sockaddr_can addr;
+  struct ifreq ifr;
+  // Only the responses, icsim answers every tester from UDS_RESP_ID + n
+  struct can_filter filter = {UDS_RESP_ID, CAN_EFF_FLAG | CAN_RTR_FLAG | 0x7F8};
+  int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+
+  if (s < 0) {
+    perror("socket");
+    return -1;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+    perror("SIOCGIFINDEX");
+    close(s);
+    return -1;
+  }
+  setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+static int send_request(int tester, const uint8_t *data, int len) {
+  struct can_frame cf;
+
+  memset(&cf, 0, sizeof(cf));
+  cf.can_id = UDS_PHYS_REQ_ID + tester;
+  cf.can_dlc = 8; // Padded like a single frame ISO-TP request
+  memcpy(cf.data, data, len);
+  // The TX queue of a busy vcan fills up, wait for room rather than losing the request
+  while (write(sock, &cf, sizeof(cf)) < 0) {
+    if (errno != ENOBUFS && errno != EAGAIN) {
+      perror("write");
+      return -1;
+    }
+    struct pollfd pfd = {sock, POLLOUT, 0};
+    poll(&pfd, 1, 1);
+  }
+  return 0;
+}
+
+static int request_seed(Tester *t, int tester, Stats *st) {
+  uint8_t req[2] = {UDS_SECURITY_REQ, UDS_SECURITY_REQ_SEED};
+
+  t->state = WAIT_SEED;
+  t->sent_us = latency_now_us();
+  st->started++;
+  return send_request(tester, req, sizeof(req));
+}
+
+static int send_key(Tester *t, int tester, uint8_t seed) {
+  uint8_t req[2 + UDS_KEY_LEN] = {UDS_SECURITY_REQ, UDS_SECURITY_REQ_KEY};
+
+  switch (key_mode) {
+  case KEY_VALID:
+    calculate_key(seed, req + 2);
+    break;
+  case KEY_WRONG:
+    calculate_key(seed, req + 2);
+    req[2] ^= 0xFF;
+    break;
+  case KEY_SWEEP:
+    t->key = next_candidate++ & 0xFFFFFF;
+    req[2] = t->key >> 16;
+    req[3] = t->key >> 8;
+    req[4] = t->key;
+    break;
+  }
+  t->state = WAIT_KEY;
+  t->sent_us = latency_now_us();
+  return send_request(tester, req, sizeof(req));
+}
+
+/* Advances the tester a response belongs to, returns 1 when its exchange finished */
+static int handle_response(Tester *testers, int ntesters, const struct can_frame *cf, Stats *st) {
+  int n = (cf->can_id & CAN_SFF_MASK) - UDS_RESP_ID;
+  uint32_t now = latency_now_us();
+  Tester *t;
+
+  if (n < 0 || n >= ntesters || testers[n].state == IDLE || cf->can_dlc < 2) {
+    st->unexpected++;
+    return 0;
+  }
+  t = &testers[n];
+  if (verbose) {
+    printf("tester %d:", n);
+    for (int i = 0; i < cf->can_dlc; i++) printf(" %02X", cf->data[i]);
+    printf("\n");
+  }
+
+  if (cf->data[0] == UDS_NEGATIVE_RESPONSE && cf->data[1] == UDS_SECURITY_REQ && cf->can_dlc >= 3) {
+    latency_add(t->state == WAIT_SEED ? &st->seed_latency : &st->key_latency, now - t->sent_us);
+    st->nrc[cf->data[2]]++;
+  } else if (cf->data[0] == UDS_SECURITY_REQ + UDS_POSITIVE_RESPONSE) {
+    if (t->state == WAIT_SEED && cf->data[1] == UDS_SECURITY_REQ_SEED && cf->can_dlc >= 3) {
+      latency_add(&st->seed_latency, now - t->sent_us);
+      return send_key(t, n, cf->data[2]) < 0 ? -1 : 0;
+    }
+    if (t->state != WAIT_KEY || cf->data[1] != UDS_SECURITY_REQ_KEY) {
+      st->unexpected++;
+      return 0;
+    }
+    latency_add(&st->key_latency, now - t->sent_us);
+    st->unlocked++;
+    if (key_mode == KEY_SWEEP) printf("Key %06X accepted by tester %d\n", t->key, n);
+  } else {
+    st->unexpected++;
+    return 0;
+  }
+  t->state = IDLE;
+  st->completed++;
+  return 1;
+}
+
+static void print_stats(const Stats *st, double secs, int histograms) {
+  printf("%ld exchanges in %.3f s, %.0f/s: %ld unlocked, %ld timeouts, %ld unexpected responses\n",
+         st->completed + st->timeouts, secs, secs > 0 ? (st->completed + st->timeouts) / secs : 0,
+         st->unlocked, st->timeouts, st->unexpected);
+  for (int i = 0; i < 256; i++)
+    if (st->nrc[i]) printf("  NRC 0x%02X: %ld\n", i, st->nrc[i]);
+  latency_print(&st->seed_latency, "seed response", histograms);
+  latency_print(&st->key_latency, "key response", histograms);
+}
+
+int main(int argc, char *argv[]) {
+  long count = DEFAULT_COUNT;
+  int ntesters = UDS_TESTERS, timeout_ms = DEFAULT_TIMEOUT_MS, histograms = 0, opt;
+  Tester testers[UDS_TESTERS];
+  Stats st;
+  uint32_t t0;
+
+  while ((opt = getopt(argc, argv, "n:c:t:k:s:Hvh?")) != -1) {
+    switch (opt) {
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'c':
+      ntesters = atoi(optarg);
+      if (ntesters < 1 || ntesters > UDS_TESTERS) usage("Testers must be 1-8");
+      break;
+    case 't':
+      timeout_ms = atoi(optarg);
+      break;
+    case 'k':
+      if (!strcmp(optarg, "valid")) {
+        key_mode = KEY_VALID;
+      } else if (!strcmp(optarg, "wrong")) {
+        key_mode = KEY_WRONG;
+      } else if (!strcmp(optarg, "sweep")) {
+        key_mode = KEY_SWEEP;
+      } else {
+        usage("Unknown key mode, use valid, wrong or sweep");
+      }
+      break;
+    case 's':
+      next_candidate = strtoul(optarg, NULL, 16);
+      break;
+    case 'H':
+      histograms = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(NULL);
+    }
+  }
+  if (optind >= argc) usage("You must specify a can device");
+
+  sock = open_socket(argv[optind]);
+  if (sock < 0) return 1;
+
+  memset(&st, 0, sizeof(st));
+  latency_reset(&st.seed_latency);
+  latency_reset(&st.key_latency);
+  memset(testers, 0, sizeof(testers));
+
+  t0 = latency_now_us();
+  for (;;) {
+    uint32_t now = latency_now_us();
+    int busy = 0, wait_ms = timeout_ms;
+
+    // Keep one exchange in flight per tester, expire the ones that went unanswered
+    for (int i = 0; i < ntesters; i++) {
+      Tester *t = &testers[i];
+      if (t->state != IDLE && now - t->sent_us >= (uint32_t)timeout_ms * 1000) {
+        st.timeouts++;
+        t->state = IDLE;
+      }
+      if (t->state == IDLE && st.started < count && request_seed(t, i, &st) < 0) return 1;
+      if (t->state != IDLE) {
+        int left = timeout_ms - (int)((now - t->sent_us) / 1000);
+        if (left < wait_ms) wait_ms = left;
+        busy++;
+      }
+    }
+    if (!busy) break;
+
+    struct pollfd pfd = {sock, POLLIN, 0};
+    if (poll(&pfd, 1, wait_ms < 1 ? 1 : wait_ms) < 0 && errno != EINTR) {
+      perror("poll");
+      return 1;
+    }
+    for (int i = 0; i < RX_BATCH; i++) {
+      struct can_frame cf;
+      if (recv(sock, &cf, sizeof(cf), MSG_DONTWAIT) != sizeof(cf)) break;
+      if (handle_response(testers, ntesters, &cf, &st) < 0) return 1;
+    }
+  }
+
+  print_stats(&st, (latency_now_us() - t0) / 1e6, histograms);
+  close(sock);
+  return st.timeouts ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Y4M recording of the cluster display
+ *
+ * The render loop only copies the composed frame into a pre-faulted buffer
+ * from a pool; converting to YUV and writing happen on a writer thread.  The
+ * video has a constant frame rate and slot n shows what was on screen at
+ * start + n / fps, where start is CLOCK_REALTIME as written in the header
+ * (XICSIM_START=seconds.micros).  That is the clock of the SO_TIMESTAMP
+ * receive times in candump logs and pcapng captures, so frames line up with
+ * the traffic that caused them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "videorec.h"
+
+#define BUF_INDEX(n) ((n) & (VIDEOREC_BUFFERS - 1))
+
+typedef struct {
+  VideoRecorder *vr;
+  uint8_t *yuv; // Last converted frame, repeated for empty slots
+  size_t yuv_len;
+  uint64_t next_slot;
+  int have_frame;
+} Writer;
+
+static uint8_t clamp8(int v) {
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* Full range BT.601 (C420jpeg), chroma averaged over 2x2 blocks with odd edges clamped */
+static void argb_to_i420(const uint32_t *px, int w, int h, uint8_t *yuv) {
+  int cw = (w + 1) / 2, ch = (h + 1) / 2;
+  uint8_t *y = yuv, *u = yuv + w * h, *v = u + cw * ch;
+
+  for (int i = 0; i < w * h; i++) {
+    int r = (px[i] >> 16) & 0xFF, g = (px[i] >> 8) & 0xFF, b = px[i] & 0xFF;
+    y[i] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+  }
+  for (int cy = 0; cy < ch; cy++) {
+    int y0 = cy * 2, y1 = (y0 + 1 < h) ? y0 + 1 : y0;
+    for (int cx = 0; cx < cw; cx++) {
+      int x0 = cx * 2, x1 = (x0 + 1 < w) ? x0 + 1 : x0;
+      uint32_t p[4] = {px[y0 * w + x0], px[y0 * w + x1], px[y1 * w + x0], px[y1 * w + x1]};
+      int r = 0, g = 0, b = 0;
+      for (int k = 0; k < 4; k++) {
+        r += (p[k] >> 16) & 0xFF;
+        g += (p[k] >> 8) & 0xFF;
+        b += p[k] & 0xFF;
+      }
+      u[cy * cw + cx] = clamp8(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128);
+      v[cy * cw + cx] = clamp8(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128);
+    }
+  }
+}
+
+static void write_all(VideoRecorder *vr, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t w = writev(vr->fd, iov, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      if (!vr->error) {
+        vr->error = errno;
+        printf("WARNING: Could not write the video %s: %s\n", vr->path, strerror(errno));
+      }
+      return;
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
+static void write_frame(Writer *wr) {
+  static char tag[] = "FRAME\n";
+  struct iovec iov[2] = {{tag, sizeof(tag) - 1}, {wr->yuv, wr->yuv_len}};
+
+  wr->next_slot++;
+  if (wr->vr->error) return;
+  write_all(wr->vr, iov, 2);
+  wr->vr->frames++;
+}
+
+/* Repeats the frame on screen until slot */
+static void fill_to(Writer *wr, uint64_t slot) {
+  while (wr->have_frame && wr->next_slot < slot) {
+    write_frame(wr);
+    wr->vr->repeated++;
+  }
+}
+
+static void write_buffer(Writer *wr, uint64_t i) {
+  VideoRecorder *vr = wr->vr;
+  uint64_t slot = vr->slots[BUF_INDEX(i)];
+
+  if (wr->have_frame && slot < wr->next_slot) {
+    vr->merged++;
+    return;
+  }
+  if (wr->have_frame) {
+    fill_to(wr, slot);
+    argb_to_i420(vr->bufs[BUF_INDEX(i)], vr->w, vr->h, wr->yuv);
+  } else {
+    // Nothing older to show, the first frame also covers the slots since the start
+    argb_to_i420(vr->bufs[BUF_INDEX(i)], vr->w, vr->h, wr->yuv);
+    wr->have_frame = 1;
+    fill_to(wr, slot);
+  }
+  write_frame(wr);
+}
+
+static void *writer_thread(void *arg) {
+  VideoRecorder *vr = arg;
+  Writer wr = {vr, NULL, 0, 0, 0};
+  uint64_t done = 0;
+
+  wr.yuv_len = (size_t)vr->w * vr->h + 2 * (size_t)((vr->w + 1) / 2) * ((vr->h + 1) / 2);
+  wr.yuv = malloc(wr.yuv_len);
+
+  pthread_mutex_lock(&vr->lock);
+  for (;;) {
+    while (vr->queued == done && !vr->stopping) pthread_cond_wait(&vr->wake, &vr->lock);
+    uint64_t end = vr->queued;
+    if (end == done) break; // Stopping and nothing left
+    pthread_mutex_unlock(&vr->lock);
+
+    for (uint64_t i = done; i < end; i++)
+      if (wr.yuv) write_buffer(&wr, i);
+    done = end;
+    // Gives the buffers back to the render loop
+    atomic_store_explicit(&vr->done, done, memory_order_release);
+
+    pthread_mutex_lock(&vr->lock);
+  }
+  uint64_t end_slot = vr->end_slot;
+  pthread_mutex_unlock(&vr->lock);
+  if (wr.yuv) fill_to(&wr, end_slot);
+
+  if (!wr.yuv && !vr->error) {
+    vr->error = ENOMEM;
+    printf("WARNING: Could not allocate the video conversion buffer\n");
+  }
+  free(wr.yuv);
+  return NULL;
+}
+
+static void free_buffers(VideoRecorder *vr) {
+  for (int i = 0; i < VIDEOREC_BUFFERS; i++) free(vr->bufs[i]);
+}
+
+int videorec_open(VideoRecorder *vr, const char *path, int w, int h, int fps) {
+  char header[128];
+  int len;
+
+  memset(vr, 0, sizeof(*vr));
+  vr->path = path;
+  vr->w = w;
+  vr->h = h;
+  vr->fps = fps;
+  for (int i = 0; i < VIDEOREC_BUFFERS; i++) {
+    vr->bufs[i] = malloc((size_t)w * h * sizeof(uint32_t));
+    if (!vr->bufs[i]) {
+      free_buffers(vr);
+      return -1;
+    }
+    // Touch every page now so capturing never takes a page fault
+    memset(vr->bufs[i], 0, (size_t)w * h * sizeof(uint32_t));
+  }
+
+  vr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (vr->fd < 0) {
+    perror(path);
+    free_buffers(vr);
+    return -1;
+  }
+  clock_gettime(CLOCK_REALTIME, &vr->start);
+  len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XICSIM_START=%ld.%06ld\n",
+                 w, h, fps, (long)vr->start.tv_sec, vr->start.tv_nsec / 1000);
+  if (write(vr->fd, header, len) != len) {
+    perror(path);
+    close(vr->fd);
+    free_buffers(vr);
+    return -1;
+  }
+
+  atomic_init(&vr->done, 0);
+  pthread_mutex_init(&vr->lock, NULL);
+  pthread_cond_init(&vr->wake, NULL);
+  if (pthread_create(&vr->writer, NULL, writer_thread, vr) != 0) {
+    printf("ERROR: Could not start the video writer\n");
+    close(vr->fd);
+    free_buffers(vr);
+    return -1;
+  }
+  return 0;
+}
+
+/* Slot of the frame on screen now */
+static uint64_t current_slot(VideoRecorder *vr) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t ns = (now.tv_sec - vr->start.tv_sec) * 1000000000LL + (now.tv_nsec - vr->start.tv_nsec);
+  return ns > 0 ? (uint64_t)ns * vr->fps / 1000000000ULL : 0;
+}
+
+uint32_t *videorec_buffer(VideoRecorder *vr) {
+  if (vr->queued - atomic_load_explicit(&vr->done, memory_order_acquire) >= VIDEOREC_BUFFERS) {
+    vr->late++;
+    return NULL;
+  }
+  return vr->bufs[BUF_INDEX(vr->queued)];
+}
+
+void videorec_submit(VideoRecorder *vr) {
+  vr->slots[BUF_INDEX(vr->queued)] = current_slot(vr);
+  pthread_mutex_lock(&vr->lock);
+  vr->queued++;
+  pthread_cond_signal(&vr->wake);
+  pthread_mutex_unlock(&vr->lock);
+}
+
+int videorec_close(VideoRecorder *vr) {
+  pthread_mutex_lock(&vr->lock);
+  vr->end_slot = current_slot(vr) + 1;
+  vr->stopping = 1;
+  pthread_cond_signal(&vr->wake);
+  pthread_mutex_unlock(&vr->lock);
+  pthread_join(vr->writer, NULL);
+
+  if (close(vr->fd) < 0 && !vr->error) vr->error = errno;
+  pthread_mutex_destroy(&vr->lock);
+  pthread_cond_destroy(&vr->wake);
+  free_buffers(vr);
+  return vr->error ? -1 : 0;
+}
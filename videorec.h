@@ -0,0 +1,52 @@
+#ifndef VIDEOREC_H
+#define VIDEOREC_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/* === Constants === */
+
+#define VIDEOREC_BUFFERS 32 // Power of two, half a second of frames at 60 fps
+
+/* === Structures === */
+
+// Y4M recording of the presented frames.  The render loop reads each frame
+// into a pooled buffer and stamps it with its slot on a fixed frame rate
+// timeline; a writer thread converts to 4:2:0 and fills the slots nothing
+// was presented in by repeating the previous frame.  Buffers are indexed by a
+// running count, as in pcapng.h.
+typedef struct {
+  int fd;
+  const char *path;
+  int w, h, fps;
+  struct timespec start; // CLOCK_REALTIME of slot 0, the clock of the CAN timestamps
+  uint32_t *bufs[VIDEOREC_BUFFERS];
+  uint64_t slots[VIDEOREC_BUFFERS];
+  uint64_t queued;       // Buffers handed to the writer, the next one is being filled
+  _Atomic uint64_t done; // Buffers the writer has finished with
+  uint64_t end_slot;     // Set by videorec_close(), the video runs up to it
+  uint64_t late;         // Presented while every buffer was queued, the slot repeats instead
+  uint64_t frames;       // Written to the file, writer only until closed
+  uint64_t repeated;
+  uint64_t merged;       // Presented twice within one slot, the first one was kept
+  int error;
+  int stopping;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} VideoRecorder;
+
+/* === Prototypes === */
+
+// Creates path and writes the stream header. Returns 0 on success
+int videorec_open(VideoRecorder *vr, const char *path, int w, int h, int fps);
+// Buffer for a w x h ARGB8888 frame, NULL (and counted) when the writer is a whole pool behind
+uint32_t *videorec_buffer(VideoRecorder *vr);
+// Queues the filled buffer as the frame on screen now
+void videorec_submit(VideoRecorder *vr);
+// Writes out the queued frames up to now and closes the file. Returns -1 if any write failed
+int videorec_close(VideoRecorder *vr);
+
+#endif // VIDEOREC_H